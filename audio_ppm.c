@@ -160,7 +160,6 @@
      // Инициализация stdio
      stdio_init_all();
      printf("PPM Encoder для Raspberry Pi Pico (аудио через лазер)\n");
-     sleep_ms(2000);  // Пауза для подключения терминала
      
      // Пин для вывода PPM сигнала
      const uint PPM_PIN = 0;
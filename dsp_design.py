@@ -0,0 +1,238 @@
+# Расчет коэффициентов DSP для энкодера и приемника (ppm_dsp.h)
+#
+# Печатает команды Q:/L: для CDC: цепочку предыскажений для передатчика и
+# обратную ей цепочку восстановления для приемника. Коэффициенты в формате
+# Q2.13, как в прошивке. Фильтры считаются на действительной частоте
+# отсчетов энкодера (sample_rate в ppm_timing.h), своей для моно и TDM,
+# поэтому наборов два.
+#
+# Здесь же эталонная реализация арифметики ppm_dsp.h бит в бит:
+#   python3 dsp_design.py                      - коэффициенты и самопроверка
+#   python3 dsp_design.py ref in.raw out.raw [tx|rx] [каналы]
+#                                              - прогон int16 LE через цепочку
+#                                                (2 канала - набор TDM)
+#   python3 dsp_design.py check путь/ppm_dsp   - сверка ref с ppm_dsp
+# Результат ref должен совпадать с выходом DspChain побайтно.
+
+import math
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import zlib
+
+# Период отсчета в мкс и частота фреймов, как в ppm_timing.h
+SAMPLE_PERIOD_US = int(133000 * 10.0 / 48000.0)
+
+
+def sample_rate(slots):
+    """ppm::sample_rate: slots фреймов TDM на период отсчета."""
+    return 1e6 / ((SAMPLE_PERIOD_US // slots) * slots)
+
+
+FS_MONO = sample_rate(1)
+FS_TDM = sample_rate(2)
+COEF_SHIFT = 13
+COEF_ONE = 1 << COEF_SHIFT
+COEF_SUM_MAX = 65535
+COEF_MIN, COEF_MAX = -32768, 32767
+LIMITER_THRESHOLD = 30000
+LIMITER_RELEASE_SHIFT = 4
+
+# Стандартное предыскажение 50/15 мкс
+TAU1 = 50e-6
+TAU2 = 15e-6
+
+
+def pre_emphasis(fs, tau1=TAU1, tau2=TAU2):
+    """H(s) = (1 + s*tau1) / (1 + s*tau2), билинейное преобразование."""
+    k = 2.0 * fs
+    a0 = 1.0 + tau2 * k
+    b0 = (1.0 + tau1 * k) / a0
+    b1 = (1.0 - tau1 * k) / a0
+    a1 = (1.0 - tau2 * k) / a0
+    return (b0, b1, 0.0, a1, 0.0)
+
+
+def shelf(kind, f0, gain_db, fs, slope=1.0):
+    """Полочный фильтр по RBJ Audio EQ Cookbook."""
+    a = 10.0 ** (gain_db / 40.0)
+    w0 = 2.0 * math.pi * f0 / fs
+    cosw = math.cos(w0)
+    alpha = math.sin(w0) / 2.0 * math.sqrt((a + 1.0 / a) * (1.0 / slope - 1.0) + 2.0)
+    sq = 2.0 * math.sqrt(a) * alpha
+    if kind == "low":
+        b0 = a * ((a + 1) - (a - 1) * cosw + sq)
+        b1 = 2 * a * ((a - 1) - (a + 1) * cosw)
+        b2 = a * ((a + 1) - (a - 1) * cosw - sq)
+        a0 = (a + 1) + (a - 1) * cosw + sq
+        a1 = -2 * ((a - 1) + (a + 1) * cosw)
+        a2 = (a + 1) + (a - 1) * cosw - sq
+    else:
+        b0 = a * ((a + 1) + (a - 1) * cosw + sq)
+        b1 = -2 * a * ((a - 1) + (a + 1) * cosw)
+        b2 = a * ((a + 1) + (a - 1) * cosw - sq)
+        a0 = (a + 1) - (a - 1) * cosw + sq
+        a1 = 2 * ((a - 1) - (a + 1) * cosw)
+        a2 = (a + 1) - (a - 1) * cosw - sq
+    return (b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0)
+
+
+def inverse(section):
+    """Обратная секция A/B (B должен быть минимально-фазовым)."""
+    b0, b1, b2, a1, a2 = section
+    return (1.0 / b0, a1 / b0, a2 / b0, b1 / b0, b2 / b0)
+
+
+def quantize(section):
+    q = tuple(int(round(c * COEF_ONE)) for c in section)
+    if any(c < COEF_MIN or c > COEF_MAX for c in q):
+        raise ValueError(f"Коэффициент вне диапазона Q2.13 int16: {q}")
+    total = sum(abs(c) for c in q)
+    if total > COEF_SUM_MAX:
+        raise ValueError(f"Сумма модулей коэффициентов {total} > {COEF_SUM_MAX}")
+    return q
+
+
+def saturate16(v):
+    return max(-32768, min(32767, v))
+
+
+class Biquad:
+    """Секция ppm::BiquadCascade для одного канала."""
+
+    def __init__(self, q):
+        self.q = q
+        self.x1 = self.x2 = self.y1 = self.y2 = self.err = 0
+
+    def step(self, x):
+        b0, b1, b2, a1, a2 = self.q
+        acc = b0 * x + b1 * self.x1 + b2 * self.x2 - a1 * self.y1 - a2 * self.y2 + self.err
+        y = acc >> COEF_SHIFT
+        self.err = acc - (y << COEF_SHIFT)
+        y = saturate16(y)
+        self.x2, self.x1 = self.x1, x
+        self.y2, self.y1 = self.y1, y
+        return y
+
+
+class Limiter:
+    """ppm::BlockLimiter."""
+
+    UNITY = 1 << 15
+
+    def __init__(self, threshold):
+        self.threshold = threshold
+        self.gain = self.UNITY
+
+    def process(self, block):
+        if self.threshold == 0 or not block:
+            return block
+        peak = max(abs(x) for x in block)
+        target = (self.threshold << 15) // peak if peak > self.threshold else self.UNITY
+        if target < self.gain:
+            self.gain = target
+        else:
+            step = (target - self.gain) >> LIMITER_RELEASE_SHIFT
+            self.gain = self.gain + step if step > 0 else target
+        if self.gain == self.UNITY:
+            return block
+        return [(x * self.gain) >> 15 for x in block]
+
+
+def run_chain(samples, sections, threshold, channels=1, block=32):
+    """ppm::DspChain: секции по порядку, затем ограничитель, блоками."""
+    filters = [[Biquad(q) for _ in range(channels)] for q in sections]
+    limiter = Limiter(threshold)
+    out = []
+    for start in range(0, len(samples), block):
+        buf = list(samples[start:start + block])
+        for chain in filters:
+            for i in range(len(buf)):
+                buf[i] = chain[(start + i) % channels].step(buf[i])
+        out.extend(limiter.process(buf))
+    return out
+
+
+def tx_sections(fs):
+    return [quantize(pre_emphasis(fs)),
+            quantize(shelf("low", 100.0, -3.0, fs)),
+            quantize(shelf("high", 8000.0, 2.0, fs))]
+
+
+def rx_sections(fs):
+    # Обратные секции в обратном порядке
+    return [quantize(inverse(shelf("high", 8000.0, 2.0, fs))),
+            quantize(inverse(shelf("low", 100.0, -3.0, fs))),
+            quantize(inverse(pre_emphasis(fs)))]
+
+
+def print_commands(title, sections, threshold):
+    print(title)
+    for i, q in enumerate(sections):
+        print(f"  Q:{i}," + ",".join(str(c) for c in q))
+    print(f"  L:{threshold}")
+
+
+def self_check(fs):
+    n = 4800
+    signal = [int(12000 * math.sin(2 * math.pi * 1000 * i / fs)
+                  + 4000 * math.sin(2 * math.pi * 12000 * i / fs)) for i in range(n)]
+    tx = run_chain(signal, tx_sections(fs), LIMITER_THRESHOLD)
+    rx = run_chain(tx, rx_sections(fs), 0)
+    err = max(abs(a - b) for a, b in zip(signal[480:], rx[480:]))
+    crc = zlib.crc32(struct.pack(f"<{n}h", *tx))
+    print(f"Проверка: 1 кГц + 12 кГц, {n} отсчетов")
+    print(f"  CRC32 выхода передатчика: {crc:08x}")
+    print(f"  Макс. ошибка после восстановления: {err} LSB")
+
+
+def reference(path_in, path_out, side="tx", channels=1):
+    data = open(path_in, "rb").read()
+    samples = list(struct.unpack(f"<{len(data) // 2}h", data[:len(data) // 2 * 2]))
+    fs = FS_TDM if channels == 2 else FS_MONO
+    if side == "tx":
+        out = run_chain(samples, tx_sections(fs), LIMITER_THRESHOLD, channels)
+    else:
+        out = run_chain(samples, rx_sections(fs), 0, channels)
+    open(path_out, "wb").write(struct.pack(f"<{len(out)}h", *out))
+
+
+def check_tool(tool):
+    """ppm_dsp (host/ppm_dsp.cpp) против ref: tx и rx, моно и TDM."""
+    n = 9600
+    signal = [int(20000 * math.sin(2 * math.pi * 997 * i / FS_MONO)
+                  + 9000 * math.sin(2 * math.pi * 11000 * i / FS_MONO))
+              for i in range(n)]
+    failed = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        path_in = os.path.join(tmp, "in.raw")
+        open(path_in, "wb").write(struct.pack(f"<{n}h", *signal))
+        for side in ("tx", "rx"):
+            for channels in (1, 2):
+                ref = os.path.join(tmp, "ref.raw")
+                out = os.path.join(tmp, "out.raw")
+                reference(path_in, ref, side, channels)
+                subprocess.run([tool, side, path_in, out, str(channels)],
+                               check=True, stdout=subprocess.DEVNULL)
+                same = open(ref, "rb").read() == open(out, "rb").read()
+                print(f"{side} x{channels}: {'OK' if same else 'FAIL'}")
+                failed += not same
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    if len(sys.argv) == 3 and sys.argv[1] == "check":
+        sys.exit(check_tool(sys.argv[2]))
+    if len(sys.argv) >= 4 and sys.argv[1] == "ref":
+        side = sys.argv[4] if len(sys.argv) > 4 else "tx"
+        channels = int(sys.argv[5]) if len(sys.argv) > 5 else 1
+        reference(sys.argv[2], sys.argv[3], side, channels)
+    else:
+        for name, fs in (("mono", FS_MONO), ("tdm", FS_TDM)):
+            print(f"== {name}, {fs:.0f} Гц")
+            print_commands("Передатчик (предыскажение 50/15 мкс, полки):",
+                           tx_sections(fs), LIMITER_THRESHOLD)
+            print_commands("Приемник (восстановление):", rx_sections(fs), 0)
+            self_check(fs)
@@ -0,0 +1,196 @@
+// Извлечение передних фронтов из записей логического анализатора.
+//
+// raw - дамп отсчётов sigrok: unitsize байт на отсчёт, бит n - канал n.
+// csv - строки отсчётов sigrok или список переходов (Saleae): если первый
+// столбец заголовка "Time...", время берётся из него, иначе номер строки
+// считается номером отсчёта. Каждый кусок записи сканируется независимо,
+// фронт на стыке кусков восстанавливает merge_chunks.
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace ppm {
+
+struct EdgeChunk {
+  // Метки фронтов: номер отсчёта от начала куска или такты энкодера,
+  // если время записано в файле
+  std::vector<uint64_t> edges;
+  uint64_t samples = 0;     // отсчётов в куске
+  uint64_t first_stamp = 0; // метка первого отсчёта
+  bool first = false;       // уровень первого отсчёта
+  bool last = false;        // уровень последнего отсчёта
+};
+
+// Канал из восьми однобайтовых отсчётов -> 8 бит, бит k - отсчёт k
+inline uint32_t gather8(uint64_t word, unsigned channel) {
+  uint64_t bits = (word >> channel) & 0x0101010101010101ull;
+  return static_cast<uint32_t>((bits * 0x0102040810204080ull) >> 56);
+}
+
+// Сканирование словами по 64 отсчёта: маска уровней, затем фронты
+// m & ~(m << 1 | предыдущий); без фронтов слово пропускается целиком
+inline void scan_raw8(const uint8_t *data, size_t samples, unsigned channel,
+                      EdgeChunk &out) {
+  out.samples = samples;
+  if (samples == 0)
+    return;
+  uint64_t prev = (data[0] >> channel) & 1u;
+  out.first = prev;
+
+  size_t i = 0;
+  for (; i + 64 <= samples; i += 64) {
+    uint64_t mask = 0;
+    for (unsigned k = 0; k < 8; k++) {
+      uint64_t word;
+      memcpy(&word, data + i + 8 * k, sizeof(word));
+      mask |= static_cast<uint64_t>(gather8(word, channel)) << (8 * k);
+    }
+    uint64_t rising = mask & ~((mask << 1) | prev);
+    prev = mask >> 63;
+    while (rising) {
+      out.edges.push_back(i + __builtin_ctzll(rising));
+      rising &= rising - 1;
+    }
+  }
+  for (; i < samples; i++) {
+    uint64_t level = (data[i] >> channel) & 1u;
+    if (level && !prev)
+      out.edges.push_back(i);
+    prev = level;
+  }
+  out.last = prev;
+}
+
+inline void scan_raw(const uint8_t *data, size_t samples, unsigned unitsize,
+                     unsigned channel, EdgeChunk &out) {
+  if (unitsize == 1) {
+    scan_raw8(data, samples, channel, out);
+    return;
+  }
+  out.samples = samples;
+  if (samples == 0)
+    return;
+  const uint8_t *p = data + channel / 8;
+  unsigned bit = channel % 8;
+  bool prev = (p[0] >> bit) & 1u;
+  out.first = prev;
+  for (size_t i = 1; i < samples; i++) {
+    bool level = (p[i * unitsize] >> bit) & 1u;
+    if (level && !prev)
+      out.edges.push_back(i);
+    prev = level;
+  }
+  out.last = prev;
+}
+
+struct CsvLayout {
+  bool has_time = false; // первый столбец - время, с
+  unsigned column = 0;   // столбец канала в строке
+  size_t data_start = 0; // смещение первой строки данных
+};
+
+inline const char *next_line(const char *p, const char *end) {
+  const void *nl = memchr(p, '\n', end - p);
+  return nl ? static_cast<const char *>(nl) + 1 : end;
+}
+
+// Пропустить комментарии ';' и разобрать заголовок, если он есть
+inline bool parse_csv_layout(const char *begin, const char *end,
+                             unsigned channel, CsvLayout &layout) {
+  const char *p = begin;
+  while (p < end && (*p == ';' || *p == '\n' || *p == '\r'))
+    p = next_line(p, end);
+  if (p == end)
+    return false;
+
+  layout = CsvLayout{};
+  const char *line_end = next_line(p, end);
+  // В строке данных только числа, в том числе с экспонентой
+  bool header = false;
+  for (const char *c = p; c < line_end && !header; c++)
+    header = !strchr("0123456789.,+-eE \t\r\n", *c);
+  if (header) {
+    layout.has_time = (line_end - p) >= 4 && strncmp(p, "Time", 4) == 0;
+    p = line_end;
+  }
+  layout.column = channel + layout.has_time;
+  layout.data_start = p - begin;
+  return true;
+}
+
+// Кусок должен начинаться с начала строки; scale - тактов в секунде
+inline void scan_csv(const char *p, const char *end, const CsvLayout &layout,
+                     double scale, EdgeChunk &out) {
+  bool prev = false;
+  uint64_t row = 0;
+  while (p < end) {
+    const char *line_end = next_line(p, end);
+    if (*p == ';' || *p == '\n' || *p == '\r') {
+      p = line_end;
+      continue;
+    }
+
+    uint64_t stamp = row;
+    if (layout.has_time) {
+      double seconds = 0;
+      std::from_chars(p, line_end, seconds);
+      stamp = static_cast<uint64_t>(std::llround(seconds * scale));
+    }
+    const char *field = p;
+    for (unsigned n = layout.column; n > 0 && field < line_end; field++) {
+      if (*field == ',')
+        n--;
+    }
+    while (field < line_end && *field == ' ')
+      field++;
+    bool level = field < line_end && *field != '0';
+
+    if (row == 0) {
+      out.first = level;
+      out.first_stamp = stamp;
+    } else if (level && !prev) {
+      out.edges.push_back(stamp);
+    }
+    prev = level;
+    row++;
+    p = line_end;
+  }
+  out.samples = row;
+  out.last = prev;
+}
+
+// Склеить куски: индексы отсчётов становятся сквозными, на стыках
+// добавляются фронты, которых не видно внутри одного куска
+inline std::vector<uint64_t> merge_chunks(std::vector<EdgeChunk> &chunks,
+                                          bool indexed) {
+  size_t total = 0;
+  for (const EdgeChunk &c : chunks)
+    total += c.edges.size() + 1;
+  std::vector<uint64_t> edges;
+  edges.reserve(total);
+
+  uint64_t offset = 0;
+  bool have_prev = false;
+  bool prev = false;
+  for (EdgeChunk &c : chunks) {
+    if (c.samples == 0)
+      continue;
+    uint64_t base = indexed ? offset : 0;
+    if (have_prev && !prev && c.first)
+      edges.push_back(base + c.first_stamp);
+    for (uint64_t e : c.edges)
+      edges.push_back(base + e);
+    offset += c.samples;
+    prev = c.last;
+    have_prev = true;
+    std::vector<uint64_t>().swap(c.edges);
+  }
+  return edges;
+}
+
+} // namespace ppm
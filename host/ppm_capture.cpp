@@ -0,0 +1,551 @@
+// Декодер записей логического анализатора: фронты -> коды PPM -> WAV.
+//
+//   ppm_capture [опции] запись.bin|запись.csv
+//
+// Запись отображается в память и сканируется кусками в нескольких
+// потоках; фреймы собираются тем же FrameDecoder, что и в прошивке
+// приёмника, по профилю частоты энкодера (ppm_timing.h). Если каналов
+// несколько (два фотоприёмника), они сводятся DiversityCombiner. С -q on
+// отсчёты проходят восстановление DSP_RX_PRESET, как в pico_ppm_rx.
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "capture_scan.h"
+#include "ppm_audio.h"
+#include "ppm_decoder.h"
+#include "ppm_dsp.h"
+#include "ppm_timing.h"
+
+namespace {
+
+enum class Format { Auto, Raw, Csv };
+
+struct Options {
+  const char *input = nullptr;
+  const char *output = nullptr;
+  Format format = Format::Auto;
+  uint64_t sample_rate = 0;
+  unsigned channels[ppm::DIVERSITY_MAX_INPUTS] = {0};
+  unsigned channel_count = 1;
+  unsigned unitsize = 1;
+  uint32_t sys_mhz = 133;
+  ppm::Modulation modulation = ppm::Modulation::Mono;
+  unsigned threads = 0;
+  bool restore = false;
+};
+
+void usage() {
+  fprintf(stderr,
+          "Использование: ppm_capture [опции] запись\n"
+          "  -f raw|csv   формат записи (по умолчанию по расширению)\n"
+          "  -r <Гц>      частота дискретизации (raw и csv без времени)\n"
+          "  -c <n>[,n]   каналы: бит отсчёта raw или столбец csv (0);\n"
+          "               несколько каналов сводятся разнесённым приёмом\n"
+          "  -u <байт>    байт на отсчёт raw, unitsize sigrok (1)\n"
+          "  -s <МГц>     системная частота энкодера (133)\n"
+          "  -m mono|tdm  модуляция (mono)\n"
+          "  -j <n>       потоков сканирования (по числу ядер)\n"
+          "  -q on|off    снять предыскажение DSP_TX_PRESET (off)\n"
+          "  -o <файл>    выходной WAV\n");
+}
+
+bool parse_options(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || arg[1] == '\0') {
+      opt.input = arg;
+      continue;
+    }
+    if (arg[2] != '\0' || i + 1 >= argc)
+      return false;
+    const char *value = argv[++i];
+    switch (arg[1]) {
+    case 'f':
+      if (strcmp(value, "raw") == 0)
+        opt.format = Format::Raw;
+      else if (strcmp(value, "csv") == 0)
+        opt.format = Format::Csv;
+      else
+        return false;
+      break;
+    case 'r':
+      opt.sample_rate = strtoull(value, nullptr, 10);
+      break;
+    case 'c': {
+      opt.channel_count = 0;
+      char *end = const_cast<char *>(value);
+      do {
+        if (opt.channel_count == ppm::DIVERSITY_MAX_INPUTS)
+          return false;
+        opt.channels[opt.channel_count++] =
+            static_cast<unsigned>(strtoul(end, &end, 10));
+      } while (*end++ == ',');
+      break;
+    }
+    case 'u':
+      opt.unitsize = static_cast<unsigned>(strtoul(value, nullptr, 10));
+      break;
+    case 's':
+      opt.sys_mhz = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+      break;
+    case 'm':
+      if (strcmp(value, "mono") == 0)
+        opt.modulation = ppm::Modulation::Mono;
+      else if (strcmp(value, "tdm") == 0)
+        opt.modulation = ppm::Modulation::Tdm;
+      else
+        return false;
+      break;
+    case 'j':
+      opt.threads = static_cast<unsigned>(strtoul(value, nullptr, 10));
+      break;
+    case 'q':
+      if (strcmp(value, "on") == 0)
+        opt.restore = true;
+      else if (strcmp(value, "off") == 0)
+        opt.restore = false;
+      else
+        return false;
+      break;
+    case 'o':
+      opt.output = value;
+      break;
+    default:
+      return false;
+    }
+  }
+  if (opt.format == Format::Auto && opt.input) {
+    const char *dot = strrchr(opt.input, '.');
+    opt.format = dot && strcasecmp(dot, ".csv") == 0 ? Format::Csv : Format::Raw;
+  }
+  for (unsigned k = 0; k < opt.channel_count; k++) {
+    if (opt.channels[k] >= 8 * opt.unitsize)
+      return false;
+  }
+  return opt.input && opt.unitsize >= 1 && opt.unitsize <= 8 && opt.sys_mhz > 0;
+}
+
+struct MappedFile {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+
+  bool open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return false;
+    }
+    size = static_cast<size_t>(st.st_size);
+    void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+      return false;
+    madvise(p, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+    data = static_cast<const uint8_t *>(p);
+    return true;
+  }
+
+  ~MappedFile() {
+    if (data)
+      munmap(const_cast<uint8_t *>(data), size);
+  }
+};
+
+std::vector<uint64_t> scan_raw_parallel(const MappedFile &file,
+                                        const Options &opt, unsigned channel,
+                                        unsigned threads, uint64_t &samples) {
+  samples = file.size / opt.unitsize;
+  // Границы кусков кратны 64 отсчётам, чтобы слова не делились
+  uint64_t per_chunk = (samples / threads + 63) & ~uint64_t(63);
+  std::vector<ppm::EdgeChunk> chunks(threads);
+  std::vector<std::thread> workers;
+  for (unsigned k = 0; k < threads; k++) {
+    uint64_t begin = std::min<uint64_t>(k * per_chunk, samples);
+    uint64_t end = std::min<uint64_t>(begin + per_chunk, samples);
+    if (k + 1 == threads)
+      end = samples;
+    workers.emplace_back([&, k, begin, end] {
+      ppm::scan_raw(file.data + begin * opt.unitsize, end - begin,
+                    opt.unitsize, channel, chunks[k]);
+    });
+  }
+  for (std::thread &w : workers)
+    w.join();
+  return ppm::merge_chunks(chunks, true);
+}
+
+std::vector<uint64_t> scan_csv_parallel(const MappedFile &file,
+                                        unsigned channel, unsigned threads,
+                                        double scale, bool &indexed,
+                                        uint64_t &samples) {
+  const char *begin = reinterpret_cast<const char *>(file.data);
+  const char *end = begin + file.size;
+  ppm::CsvLayout layout;
+  if (!ppm::parse_csv_layout(begin, end, channel, layout))
+    return {};
+  indexed = !layout.has_time;
+
+  // Куски начинаются с новой строки
+  std::vector<const char *> bounds{begin + layout.data_start};
+  size_t step = (file.size - layout.data_start) / threads;
+  for (unsigned k = 1; k < threads; k++) {
+    const char *p = std::max(bounds.back(), bounds.front() + k * step);
+    bounds.push_back(p < end ? ppm::next_line(p, end) : end);
+  }
+  bounds.push_back(end);
+
+  std::vector<ppm::EdgeChunk> chunks(threads);
+  std::vector<std::thread> workers;
+  for (unsigned k = 0; k < threads; k++) {
+    workers.emplace_back([&, k] {
+      ppm::scan_csv(bounds[k], bounds[k + 1], layout, scale, chunks[k]);
+    });
+  }
+  for (std::thread &w : workers)
+    w.join();
+  samples = 0;
+  for (const ppm::EdgeChunk &c : chunks)
+    samples += c.samples;
+  return ppm::merge_chunks(chunks, indexed);
+}
+
+// Номер отсчёта -> такты энкодера без переполнения 64 бит
+uint64_t sample_to_cycles(uint64_t index, uint64_t rate, uint64_t sys_hz) {
+  return index / rate * sys_hz + index % rate * sys_hz / rate;
+}
+
+void put_le(FILE *f, uint32_t v, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    fputc((v >> (8 * i)) & 0xFF, f);
+}
+
+void write_wav_header(FILE *f, uint32_t rate, uint16_t channels,
+                      uint32_t frames) {
+  uint32_t data_size = frames * channels * 2;
+  fwrite("RIFF", 1, 4, f);
+  put_le(f, 36 + data_size, 4);
+  fwrite("WAVEfmt ", 1, 8, f);
+  put_le(f, 16, 4);
+  put_le(f, 1, 2); // PCM
+  put_le(f, channels, 2);
+  put_le(f, rate, 4);
+  put_le(f, rate * channels * 2, 4);
+  put_le(f, channels * 2, 2);
+  put_le(f, 16, 2);
+  fwrite("data", 1, 4, f);
+  put_le(f, data_size, 4);
+}
+
+struct PeriodStats {
+  uint64_t count = 0;
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  double sum = 0;
+  double sum_sq = 0;
+
+  void add(uint32_t period) {
+    count++;
+    min = std::min(min, period);
+    max = std::max(max, period);
+    sum += period;
+    sum_sq += static_cast<double>(period) * period;
+  }
+};
+
+// Фреймы одного канала в порядке времени
+struct ChannelFrames {
+  std::vector<ppm::Frame> frames;
+  std::vector<uint8_t> locked; // декодер был в захвате
+  ppm::DecoderStats stats;
+};
+
+ChannelFrames decode_channel(const std::vector<uint64_t> &edges,
+                             const ppm::DecoderConfig &cfg) {
+  ChannelFrames out;
+  out.frames.reserve(edges.size() / 2 + 16);
+  out.locked.reserve(edges.size() / 2 + 16);
+  ppm::FrameDecoder decoder(cfg);
+  for (uint64_t e : edges) {
+    ppm::Frame frame;
+    if (decoder.push(static_cast<uint32_t>(e), frame)) {
+      out.frames.push_back(frame);
+      out.locked.push_back(decoder.isLocked());
+    }
+  }
+  out.stats = decoder.getStats();
+  return out;
+}
+
+// Каналы сводятся блоками по DIVERSITY_BLOCK_PERIODS периодов, как в
+// прошивке приёмника
+constexpr size_t DIVERSITY_CAPACITY = 256;
+constexpr uint32_t DIVERSITY_BLOCK_PERIODS = 64;
+
+template <size_t N>
+std::vector<ppm::Frame> combine_channels(const std::vector<ChannelFrames> &in,
+                                         uint32_t period,
+                                         ppm::DiversityStats &stats) {
+  auto combiner =
+      std::make_unique<ppm::DiversityCombiner<N, DIVERSITY_CAPACITY>>(period);
+  std::vector<ppm::Frame> out;
+  std::vector<ppm::Frame> block(N * DIVERSITY_CAPACITY);
+  auto before = [](uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+  };
+
+  bool any = false;
+  uint32_t first = 0, last = 0;
+  for (const ChannelFrames &c : in) {
+    if (c.frames.empty())
+      continue;
+    if (!any || before(c.frames.front().start, first))
+      first = c.frames.front().start;
+    if (!any || before(last, c.frames.back().start))
+      last = c.frames.back().start;
+    any = true;
+  }
+  if (!any)
+    return out;
+
+  size_t next[N] = {};
+  uint32_t horizon = first;
+  bool more = true;
+  while (more) {
+    horizon += DIVERSITY_BLOCK_PERIODS * period;
+    more = false;
+    for (size_t i = 0; i < N; i++) {
+      const ChannelFrames &c = in[i];
+      while (next[i] < c.frames.size() &&
+             before(c.frames[next[i]].start, horizon)) {
+        combiner->push(i, c.frames[next[i]], c.locked[next[i]]);
+        next[i]++;
+      }
+      more |= next[i] < c.frames.size();
+    }
+    // Последний блок закрывает все слоты
+    if (!more)
+      horizon = last + 2 * period;
+    size_t n = combiner->combine(horizon, block.data(), block.size());
+    out.insert(out.end(), block.begin(), block.begin() + n);
+  }
+  stats = combiner->getStats();
+  return out;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parse_options(argc, argv, opt)) {
+    usage();
+    return 2;
+  }
+
+  MappedFile file;
+  if (!file.open(opt.input)) {
+    fprintf(stderr, "Не удалось открыть %s\n", opt.input);
+    return 1;
+  }
+
+  const ppm::TimingProfile timing = ppm::make_timing_profile(
+      opt.sys_mhz * 1000, ppm::modulation_slots(opt.modulation));
+  const uint64_t sys_hz = uint64_t(opt.sys_mhz) * 1000000;
+  unsigned threads = opt.threads ? opt.threads : std::thread::hardware_concurrency();
+  threads = std::max(1u, threads);
+
+  auto t0 = std::chrono::steady_clock::now();
+  uint64_t samples = 0;
+  bool indexed = true;
+  size_t edge_count = 0;
+  std::vector<std::vector<uint64_t>> edges(opt.channel_count);
+  for (unsigned k = 0; k < opt.channel_count; k++) {
+    edges[k] = opt.format == Format::Csv
+                   ? scan_csv_parallel(file, opt.channels[k], threads,
+                                       double(sys_hz), indexed, samples)
+                   : scan_raw_parallel(file, opt, opt.channels[k], threads,
+                                       samples);
+    edge_count += edges[k].size();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  if (indexed && opt.sample_rate == 0) {
+    fprintf(stderr, "Для записи без времени нужна частота дискретизации -r\n");
+    return 2;
+  }
+  // Шаг отсчёта анализатора в тактах энкодера расширяет допуски декодера
+  const uint32_t quantum =
+      indexed ? static_cast<uint32_t>((sys_hz + opt.sample_rate - 1) /
+                                      opt.sample_rate)
+              : 1;
+  const ppm::DecoderConfig decoder_config =
+      ppm::make_decoder_config(timing, quantum);
+  std::vector<ChannelFrames> inputs;
+  for (std::vector<uint64_t> &channel_edges : edges) {
+    if (indexed) {
+      for (uint64_t &e : channel_edges)
+        e = sample_to_cycles(e, opt.sample_rate, sys_hz);
+    }
+    inputs.push_back(decode_channel(channel_edges, decoder_config));
+    std::vector<uint64_t>().swap(channel_edges);
+  }
+
+  std::vector<ppm::Frame> frames;
+  ppm::DiversityStats diversity;
+  static_assert(ppm::DIVERSITY_MAX_INPUTS == 4,
+                "combine_channels is instantiated for 2..4 inputs");
+  switch (opt.channel_count) {
+  case 1:
+    for (size_t j = 0; j < inputs[0].frames.size(); j++) {
+      if (inputs[0].locked[j])
+        frames.push_back(inputs[0].frames[j]);
+    }
+    break;
+  case 2:
+    frames = combine_channels<2>(inputs, timing.frame_cycles, diversity);
+    break;
+  case 3:
+    frames = combine_channels<3>(inputs, timing.frame_cycles, diversity);
+    break;
+  default:
+    frames = combine_channels<4>(inputs, timing.frame_cycles, diversity);
+    break;
+  }
+
+  ppm::TdmDeinterleaver deinterleaver;
+  const bool tdm = opt.modulation == ppm::Modulation::Tdm;
+  std::vector<int16_t> pcm;
+  pcm.reserve(frames.size() + 16);
+  PeriodStats period;
+  uint32_t concealed = 0;
+  uint16_t code_min = UINT16_MAX, code_max = 0;
+  bool have_last = false;
+  uint32_t last_start = 0;
+  int16_t held[2] = {0, 0};
+
+  for (const ppm::Frame &frame : frames) {
+    // Пропущенные фреймы заполняются повтором последнего отсчёта
+    if (have_last) {
+      uint32_t spacing = frame.start - last_start;
+      uint32_t periods =
+          (spacing + timing.frame_cycles / 2) / timing.frame_cycles;
+      if (periods == 1)
+        period.add(spacing);
+      for (uint32_t k = tdm ? 2 : 1; k < periods; k += tdm ? 2 : 1) {
+        pcm.insert(pcm.end(), held, held + (tdm ? 2 : 1));
+        concealed++;
+      }
+    }
+    have_last = true;
+    last_start = frame.start;
+
+    if (frame.code == ppm::SYNC_CODE) {
+      // Отсчёт, место которого заняла преамбула, тоже повторяется
+      if (tdm)
+        deinterleaver.push(frame.code, held[0], held[1]);
+      pcm.insert(pcm.end(), held, held + (tdm ? 2 : 1));
+      concealed++;
+      continue;
+    }
+    code_min = std::min(code_min, frame.code);
+    code_max = std::max(code_max, frame.code);
+
+    if (tdm) {
+      if (deinterleaver.push(frame.code, held[0], held[1]))
+        pcm.insert(pcm.end(), held, held + 2);
+    } else {
+      held[0] = ppm::code_to_pcm(std::min<uint16_t>(frame.code, ppm::MAX_CODE - 1),
+                                 ppm::MAX_CODE);
+      pcm.push_back(held[0]);
+    }
+  }
+  const uint16_t channels = tdm ? 2 : 1;
+  if (opt.restore) {
+    ppm::DspChain restore;
+    restore.setChannels(channels);
+    ppm::load_dsp_preset(restore, ppm::DSP_RX_PRESET[channels - 1], 0);
+    restore.process(pcm.data(), pcm.size());
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  if (opt.output) {
+    FILE *f = fopen(opt.output, "wb");
+    if (!f) {
+      fprintf(stderr, "Не удалось создать %s\n", opt.output);
+      return 1;
+    }
+    // Частота отсчётов - частота фреймов энкодера, а не номинальные 48 кГц
+    const uint32_t rate =
+        static_cast<uint32_t>(std::lround(ppm::sample_rate(timing)));
+    write_wav_header(f, rate, channels,
+                     static_cast<uint32_t>(pcm.size() / channels));
+    fwrite(pcm.data(), sizeof(int16_t), pcm.size(), f);
+    fclose(f);
+  }
+
+  double scan_s = std::chrono::duration<double>(t1 - t0).count();
+  double decode_s = std::chrono::duration<double>(t2 - t1).count();
+  printf("capture: %zu bytes, %llu samples, %zu edges, %u threads\n",
+         file.size, static_cast<unsigned long long>(samples), edge_count,
+         threads);
+  printf("scan: %.3f s, %.1f MB/s; decode: %.3f s\n", scan_s,
+         file.size / 1e6 / std::max(scan_s, 1e-9), decode_s);
+  if (opt.channel_count == 1) {
+    const ppm::DecoderStats &stats = inputs[0].stats;
+    printf("frames=%u lost=%u spurious=%u keepalive=%u sync=%u locks=%u "
+           "concealed=%u",
+           stats.frames, stats.lost, stats.spurious, stats.keepalive,
+           stats.sync, stats.lock_count, concealed);
+  } else {
+    for (unsigned k = 0; k < opt.channel_count; k++) {
+      const ppm::DecoderStats &stats = inputs[k].stats;
+      printf("input %u (channel %u): frames=%u lost=%u spurious=%u "
+             "keepalive=%u sync=%u locks=%u missed=%u rejected=%u "
+             "overflow=%u\n",
+             k, opt.channels[k], stats.frames, stats.lost, stats.spurious,
+             stats.keepalive, stats.sync, stats.lock_count,
+             diversity.missed[k], diversity.rejected[k], diversity.overflow[k]);
+    }
+    printf("combined: frames=%u merged=%u disagree=%u lost=%u concealed=%u",
+           diversity.frames, diversity.merged, diversity.disagree,
+           diversity.lost, concealed);
+  }
+  if (tdm)
+    printf(" orphans=%u", deinterleaver.getOrphans());
+  printf("\n");
+  // Время до захвата: с первого импульса записи или после потери захвата
+  for (unsigned k = 0; k < opt.channel_count; k++) {
+    const ppm::DecoderStats &stats = inputs[k].stats;
+    if (stats.lock_count == 0)
+      continue;
+    if (opt.channel_count > 1)
+      printf("input %u ", k);
+    printf("lock: sync_locks=%u last_us=%.1f max_us=%.1f\n", stats.sync_locks,
+           stats.lock_cycles * 1e6 / sys_hz,
+           stats.lock_cycles_max * 1e6 / sys_hz);
+  }
+  if (period.count > 0) {
+    double mean = period.sum / period.count;
+    double jitter = std::sqrt(std::max(0.0, period.sum_sq / period.count - mean * mean));
+    printf("period_cycles: nominal=%u mean=%.2f min=%u max=%u jitter_rms=%.2f\n",
+           timing.frame_cycles, mean, period.min, period.max, jitter);
+    printf("codes: min=%u max=%u\n", code_min, code_max);
+  }
+  printf("pcm: %zu samples x %u channels at %.0f Hz\n", pcm.size() / channels,
+         channels, ppm::sample_rate(timing));
+  return 0;
+}
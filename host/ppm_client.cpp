@@ -0,0 +1,229 @@
+#include "ppm_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+
+namespace ppm {
+
+namespace {
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+void StreamBlock::frame(BlockType type, size_t count) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  int16_t *s = samples();
+  for (size_t i = 0; i < count; i++)
+    s[i] = static_cast<int16_t>(__builtin_bswap16(static_cast<uint16_t>(s[i])));
+#endif
+  data[0] = BLOCK_MAGIC;
+  data[1] = static_cast<uint8_t>(type);
+  data[2] = static_cast<uint8_t>(count & 0xFF);
+  data[3] = static_cast<uint8_t>(count >> 8);
+  size = BLOCK_HEADER_SIZE + 2 * count;
+  sent = 0;
+}
+
+BlockPool::BlockPool(size_t count_)
+    : blocks(new StreamBlock[count_]), freeList(new StreamBlock *[count_]),
+      count(count_), freeCount(count_) {
+  for (size_t i = 0; i < count; i++)
+    freeList[i] = &blocks[i];
+}
+
+StreamBlock *BlockPool::acquire() {
+  if (freeCount == 0)
+    return nullptr;
+  StreamBlock *block = freeList[--freeCount];
+  if (inUse() > maxInUse)
+    maxInUse = inUse();
+  return block;
+}
+
+void BlockPool::release(StreamBlock *block) { freeList[freeCount++] = block; }
+
+StreamClient::StreamClient(size_t pool_blocks, size_t block_samples)
+    : pool(pool_blocks),
+      blockSamples(block_samples > CLIENT_MAX_BLOCK_SAMPLES
+                       ? CLIENT_MAX_BLOCK_SAMPLES
+                       : block_samples),
+      ready(new StreamBlock *[pool_blocks]) {}
+
+StreamClient::~StreamClient() { close(); }
+
+bool StreamClient::open(const char *path) {
+  close();
+  fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0)
+    return false;
+
+  // Сырой режим: без эха и построчной обработки драйвером tty
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+
+  epfd = epoll_create1(0);
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void StreamClient::close() {
+  if (epfd >= 0)
+    ::close(epfd);
+  if (fd >= 0)
+    ::close(fd);
+  epfd = fd = -1;
+}
+
+void StreamClient::drainInput() {
+  char buf[256];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    stats.bytes_received += n;
+    if (textSink)
+      textSink(buf, static_cast<size_t>(n));
+  }
+}
+
+// Дождаться готовности порта; попутно забрать всё, что прислало устройство
+bool StreamClient::pump(bool want_write, int timeout_ms) {
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  if (want_write)
+    ev.events |= EPOLLOUT;
+  ev.data.fd = fd;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+
+  struct epoll_event out;
+  int n = epoll_wait(epfd, &out, 1, timeout_ms);
+  if (n < 0)
+    return errno == EINTR;
+  if (n > 0) {
+    if (out.events & (EPOLLERR | EPOLLHUP))
+      return false;
+    if (out.events & EPOLLIN)
+      drainInput();
+  }
+  return true;
+}
+
+bool StreamClient::writeAll(const uint8_t *data, size_t len, int timeout_ms) {
+  uint64_t deadline = now_ns() + uint64_t(timeout_ms) * 1000000;
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n > 0) {
+      data += n;
+      len -= static_cast<size_t>(n);
+      continue;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+      return false;
+    if (now_ns() > deadline || !pump(true, 10))
+      return false;
+  }
+  return true;
+}
+
+bool StreamClient::command(std::string_view line, int timeout_ms) {
+  if (fd < 0)
+    return false;
+  if (!writeAll(reinterpret_cast<const uint8_t *>(line.data()), line.size(),
+                timeout_ms) ||
+      !writeAll(reinterpret_cast<const uint8_t *>("\r"), 1, timeout_ms))
+    return false;
+  // Ответ приходит одной порцией после обработки строки
+  uint64_t deadline = now_ns() + uint64_t(timeout_ms) * 1000000;
+  while (now_ns() < deadline) {
+    if (!pump(false, 10))
+      return false;
+  }
+  return true;
+}
+
+bool StreamClient::run(const Source &source) {
+  if (fd < 0)
+    return false;
+  const size_t capacity = pool.capacity();
+  uint64_t start = now_ns();
+  bool eof = false;
+
+  while (!eof || readyCount > 0) {
+    // Заполнить свободные блоки пула
+    while (!eof) {
+      StreamBlock *block = pool.acquire();
+      if (!block)
+        break;
+      size_t count = source(block->samples(), blockSamples);
+      if (count == 0) {
+        pool.release(block);
+        eof = true;
+        break;
+      }
+      bool marker = markerInterval &&
+                    (stats.blocks_sent + readyCount) % markerInterval == 0;
+      block->frame(marker ? BlockType::Marker : BlockType::Pcm, count);
+      stats.markers_sent += marker;
+      stats.samples_sent += count;
+      ready[(readyHead + readyCount) % capacity] = block;
+      readyCount++;
+    }
+
+    // Отдать порту столько, сколько он примет
+    bool blocked = false;
+    while (readyCount > 0) {
+      StreamBlock *block = ready[readyHead];
+      ssize_t n = write(fd, block->data + block->sent, block->size - block->sent);
+      stats.write_calls++;
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno != EAGAIN)
+          return false;
+        stats.would_block++;
+        blocked = true;
+        break;
+      }
+      block->sent += static_cast<size_t>(n);
+      stats.bytes_sent += static_cast<uint64_t>(n);
+      if (block->sent < block->size)
+        continue;
+      stats.blocks_sent++;
+      readyHead = (readyHead + 1) % capacity;
+      readyCount--;
+      pool.release(block);
+    }
+
+    if (blocked) {
+      uint64_t wait_start = now_ns();
+      if (!pump(true, 100))
+        return false;
+      stats.blocked_ns += now_ns() - wait_start;
+    } else {
+      drainInput();
+    }
+  }
+
+  stats.elapsed_ns = now_ns() - start;
+  stats.pool_high_water = pool.highWater();
+  return true;
+}
+
+} // namespace ppm
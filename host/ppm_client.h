@@ -0,0 +1,111 @@
+// Клиент потока PCM для CDC-порта энкодера (/dev/ttyACM*).
+//
+// Блоки берутся из пула, выделенного заранее: заголовок и отсчёты лежат
+// в блоке подряд, источник пишет отсчёты прямо на место, и блок уходит
+// в порт без копирования. Запись неблокирующая, ожидание через epoll;
+// пока устройство не читает (очередь отсчётов полна), клиент копит
+// статистику противодавления.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+#include "ppm_stream.h"
+
+namespace ppm {
+
+constexpr size_t CLIENT_MAX_BLOCK_SAMPLES = 1024;
+
+struct StreamBlock {
+  alignas(4) uint8_t data[BLOCK_HEADER_SIZE + 2 * CLIENT_MAX_BLOCK_SAMPLES];
+  size_t size = 0; // байт в кадре
+  size_t sent = 0; // уже записано в порт
+
+  int16_t *samples() {
+    return reinterpret_cast<int16_t *>(data + BLOCK_HEADER_SIZE);
+  }
+
+  // Дописать заголовок перед отсчётами; отсчёты передаются в LE
+  void frame(BlockType type, size_t count);
+};
+
+// Пул блоков без выделения памяти во время потока
+class BlockPool {
+public:
+  explicit BlockPool(size_t count);
+
+  StreamBlock *acquire();
+  void release(StreamBlock *block);
+
+  size_t capacity() const { return count; }
+  size_t inUse() const { return count - freeCount; }
+  size_t highWater() const { return maxInUse; }
+
+private:
+  std::unique_ptr<StreamBlock[]> blocks;
+  std::unique_ptr<StreamBlock *[]> freeList;
+  size_t count;
+  size_t freeCount;
+  size_t maxInUse = 0;
+};
+
+struct ClientStats {
+  uint64_t bytes_sent = 0;
+  uint64_t samples_sent = 0;
+  uint64_t blocks_sent = 0;
+  uint64_t markers_sent = 0;
+  uint64_t write_calls = 0;
+  uint64_t would_block = 0;  // записей, упёршихся в полный порт
+  uint64_t blocked_ns = 0;   // время ожидания готовности порта
+  uint64_t bytes_received = 0;
+  uint64_t elapsed_ns = 0;
+  size_t pool_high_water = 0;
+};
+
+class StreamClient {
+public:
+  // Источник заполняет dst не больше чем max отсчётами; 0 - конец потока
+  using Source = std::function<size_t(int16_t *dst, size_t max)>;
+  // Текст от устройства (эхо и ответы на команды)
+  using TextSink = std::function<void(const char *data, size_t len)>;
+
+  StreamClient(size_t pool_blocks, size_t block_samples);
+  ~StreamClient();
+
+  bool open(const char *path);
+  void close();
+
+  void setTextSink(TextSink sink) { textSink = std::move(sink); }
+  // Каждый n-й блок отправляется как метка замера задержки, 0 - никогда
+  void setMarkerInterval(uint32_t n) { markerInterval = n; }
+
+  // Отправить строку команды и собрать ответ за timeout_ms
+  bool command(std::string_view line, int timeout_ms);
+
+  // Передать весь поток; false при ошибке порта
+  bool run(const Source &source);
+
+  const ClientStats &getStats() const { return stats; }
+  size_t getBlockSamples() const { return blockSamples; }
+
+private:
+  bool writeAll(const uint8_t *data, size_t len, int timeout_ms);
+  bool pump(bool want_write, int timeout_ms);
+  void drainInput();
+
+  BlockPool pool;
+  size_t blockSamples;
+  std::unique_ptr<StreamBlock *[]> ready; // кольцо блоков на отправку
+  size_t readyHead = 0;
+  size_t readyCount = 0;
+  int fd = -1;
+  int epfd = -1;
+  uint32_t markerInterval = 0;
+  TextSink textSink;
+  ClientStats stats;
+};
+
+} // namespace ppm
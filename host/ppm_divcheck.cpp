@@ -0,0 +1,200 @@
+// Проверка сведения входов: чистый поток на входе 0, шум на входе 1.
+//
+//   ppm_divcheck [опции]
+//
+// Вход 0 принимает поток энкодера (синус, -d - вероятность потери
+// импульса), вход 1 - случайные пары импульсов с допустимым интервалом
+// (-e пар на период). Каждый вход декодирует свой FrameDecoder, фреймы
+// сводит DiversityCombiner блоками, как в pico_ppm_rx. После захвата
+// входа 0 каждый сведённый фрейм должен совпадать с переданным, а шум
+// входа 1 - уходить в rejected. Код возврата 1, если это не так.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "ppm_audio.h"
+#include "ppm_decoder.h"
+#include "ppm_timing.h"
+
+namespace {
+
+struct Options {
+  uint32_t frames = 199;
+  double pairs = 2;
+  double drop = 0;
+  uint64_t seed = 1;
+};
+
+void usage() {
+  fprintf(stderr,
+          "Использование: ppm_divcheck [опции]\n"
+          "  -n <n>  фреймов на входе 0 (199)\n"
+          "  -e <n>  случайных пар импульсов на период на входе 1 (2)\n"
+          "  -d <p>  вероятность потери импульса на входе 0 (0)\n"
+          "  -x <n>  зерно генератора (1)\n");
+}
+
+bool parse_options(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || i + 1 >= argc)
+      return false;
+    const char *value = argv[++i];
+    switch (arg[1]) {
+    case 'n':
+      opt.frames = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+      break;
+    case 'e':
+      opt.pairs = strtod(value, nullptr);
+      break;
+    case 'd':
+      opt.drop = strtod(value, nullptr);
+      break;
+    case 'x':
+      opt.seed = strtoull(value, nullptr, 10);
+      break;
+    default:
+      return false;
+    }
+  }
+  return opt.frames > 0 && opt.pairs >= 0 && opt.drop >= 0 && opt.drop < 1;
+}
+
+struct InputFrames {
+  std::vector<ppm::Frame> frames;
+  std::vector<bool> locked;
+  uint32_t lock_at = 0; // начало первого фрейма в захвате
+  bool ever_locked = false;
+};
+
+InputFrames decode(std::vector<uint32_t> &pulses,
+                   const ppm::DecoderConfig &cfg) {
+  std::sort(pulses.begin(), pulses.end());
+  InputFrames out;
+  ppm::FrameDecoder decoder(cfg);
+  for (uint32_t t : pulses) {
+    ppm::Frame frame;
+    if (!decoder.push(t, frame))
+      continue;
+    bool locked = decoder.isLocked();
+    if (locked && !out.ever_locked) {
+      out.ever_locked = true;
+      out.lock_at = frame.start;
+    }
+    out.frames.push_back(frame);
+    out.locked.push_back(locked);
+  }
+  return out;
+}
+
+// Блоки по 8 периодов: примерно столько накапливает кольцо между poll()
+constexpr uint32_t BLOCK_PERIODS = 8;
+constexpr size_t CAPACITY = 64;
+
+std::vector<ppm::Frame> combine(const InputFrames (&in)[2], uint32_t period,
+                                uint32_t end, ppm::DiversityStats &stats) {
+  auto combiner =
+      std::make_unique<ppm::DiversityCombiner<2, CAPACITY>>(period);
+  std::vector<ppm::Frame> out;
+  std::vector<ppm::Frame> block(2 * CAPACITY);
+  size_t next[2] = {};
+  for (uint32_t horizon = 0; horizon < end + 2 * period;) {
+    horizon += BLOCK_PERIODS * period;
+    for (size_t i = 0; i < 2; i++) {
+      while (next[i] < in[i].frames.size() &&
+             in[i].frames[next[i]].start < horizon) {
+        combiner->push(i, in[i].frames[next[i]], in[i].locked[next[i]]);
+        next[i]++;
+      }
+    }
+    size_t n = combiner->combine(horizon, block.data(), block.size());
+    out.insert(out.end(), block.begin(), block.begin() + n);
+  }
+  stats = combiner->getStats();
+  return out;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parse_options(argc, argv, opt)) {
+    usage();
+    return 2;
+  }
+
+  const ppm::TimingProfile timing =
+      ppm::make_timing_profile(ppm::SAMPLE_PERIOD_BASE_KHZ, 1);
+  const ppm::DecoderConfig cfg = ppm::make_decoder_config(timing);
+  const uint32_t period = timing.frame_cycles;
+  std::mt19937_64 rng(opt.seed);
+  auto chance = [&](double p) {
+    return p > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < p;
+  };
+
+  std::vector<uint32_t> pulses[2];
+  std::vector<uint32_t> sent;
+  const uint32_t origin = period;
+  for (uint32_t k = 0; k < opt.frames; k++) {
+    double s = 32000 * sin(2 * M_PI * 1000 * k / ppm::sample_rate(timing));
+    uint16_t code = ppm::pcm_to_code(static_cast<int16_t>(s), ppm::MAX_CODE);
+    uint32_t start = origin + k * period;
+    sent.push_back(start);
+    for (uint32_t t : {start, start + ppm::code_gap(timing, code)}) {
+      if (!chance(opt.drop))
+        pulses[0].push_back(t);
+    }
+  }
+  const uint32_t end = origin + opt.frames * period;
+  std::poisson_distribution<uint32_t> noise(opt.pairs);
+  std::uniform_int_distribution<uint32_t> code(0, ppm::MAX_CODE - 1);
+  for (uint32_t start = 0; start < end; start += period) {
+    for (uint32_t n = opt.pairs > 0 ? noise(rng) : 0; n > 0; n--) {
+      uint32_t t = start + std::uniform_int_distribution<uint32_t>(
+                               0, period - 1)(rng);
+      pulses[1].push_back(t);
+      pulses[1].push_back(t + ppm::code_gap(timing, code(rng)));
+    }
+  }
+
+  const InputFrames in[2] = {decode(pulses[0], cfg), decode(pulses[1], cfg)};
+  ppm::DiversityStats stats;
+  std::vector<ppm::Frame> frames = combine(in, period, end, stats);
+
+  // После захвата входа 0 сведённый фрейм - только переданный
+  uint32_t bogus = 0, matched = 0;
+  for (const ppm::Frame &f : frames) {
+    if (!in[0].ever_locked || f.start < in[0].lock_at)
+      continue;
+    uint32_t k = (f.start - origin + period / 2) / period;
+    int32_t offset = static_cast<int32_t>(f.start - sent[std::min<size_t>(
+                                                        k, sent.size() - 1)]);
+    if (std::abs(offset) <= static_cast<int32_t>(cfg.tolerance))
+      matched++;
+    else
+      bogus++;
+  }
+  const uint32_t after_lock =
+      in[0].ever_locked
+          ? static_cast<uint32_t>(
+                end - in[0].lock_at + period / 2) / period
+          : 0;
+
+  printf("input0: frames=%zu lock_at=%u\n", in[0].frames.size(),
+         in[0].lock_at);
+  printf("input1: frames=%zu rejected=%u\n", in[1].frames.size(),
+         stats.rejected[1]);
+  printf("combined: frames=%zu matched=%u bogus=%u lost=%u (sent after "
+         "lock %u)\n",
+         frames.size(), matched, bogus, stats.lost, after_lock);
+
+  bool ok = in[0].ever_locked && bogus == 0 &&
+            (opt.pairs == 0 || stats.rejected[1] > 0) &&
+            (opt.drop > 0 || matched == after_lock);
+  printf("%s\n", ok ? "OK" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+// Прогон DspChain над файлом отсчётов для сверки с dsp_design.py.
+//
+//   ppm_dsp tx|rx вход.raw выход.raw [каналы]
+//
+// Вход и выход - int16 little-endian, каналы чередуются. Набор секций -
+// DSP_TX_PRESET с ограничителем или DSP_RX_PRESET (ppm_dsp.h) для моно
+// или, при двух каналах, для TDM, блоки по
+// DSP_REF_BLOCK отсчётов, как в run_chain из dsp_design.py, поэтому выход
+// должен совпасть побайтно с
+//
+//   python3 dsp_design.py ref вход.raw эталон.raw tx|rx [каналы]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ppm_dsp.h"
+
+namespace {
+
+constexpr size_t DSP_REF_BLOCK = 32;
+
+void usage() {
+  fprintf(stderr,
+          "Использование: ppm_dsp tx|rx вход.raw выход.raw [каналы]\n"
+          "  tx - предыскажение и ограничитель, rx - восстановление;\n"
+          "  каналы 1 (набор моно) или 2 (набор TDM) (1)\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 4 || argc > 5) {
+    usage();
+    return 2;
+  }
+  const bool tx = strcmp(argv[1], "tx") == 0;
+  if (!tx && strcmp(argv[1], "rx") != 0) {
+    usage();
+    return 2;
+  }
+  unsigned long channels = argc > 4 ? strtoul(argv[4], nullptr, 10) : 1;
+  if (channels < 1 || channels > ppm::DSP_MAX_CHANNELS) {
+    usage();
+    return 2;
+  }
+
+  FILE *in = fopen(argv[2], "rb");
+  if (!in) {
+    fprintf(stderr, "Не удалось открыть %s\n", argv[2]);
+    return 1;
+  }
+  std::vector<int16_t> samples;
+  int16_t buf[DSP_REF_BLOCK];
+  size_t n;
+  while ((n = fread(buf, sizeof(int16_t), DSP_REF_BLOCK, in)) > 0)
+    samples.insert(samples.end(), buf, buf + n);
+  fclose(in);
+
+  ppm::DspChain chain;
+  chain.setChannels(channels);
+  if (!ppm::load_dsp_preset(chain,
+                            tx ? ppm::DSP_TX_PRESET[channels - 1]
+                               : ppm::DSP_RX_PRESET[channels - 1],
+                            tx ? ppm::DSP_TX_PRESET_LIMITER : 0)) {
+    fprintf(stderr, "Набор секций не проходит проверку\n");
+    return 1;
+  }
+  for (size_t start = 0; start < samples.size(); start += DSP_REF_BLOCK) {
+    size_t count = samples.size() - start;
+    chain.process(samples.data() + start,
+                  count < DSP_REF_BLOCK ? count : DSP_REF_BLOCK);
+  }
+
+  FILE *out = fopen(argv[3], "wb");
+  if (!out) {
+    fprintf(stderr, "Не удалось создать %s\n", argv[3]);
+    return 1;
+  }
+  fwrite(samples.data(), sizeof(int16_t), samples.size(), out);
+  fclose(out);
+  printf("%s: %zu samples x %lu channels\n", tx ? "tx" : "rx",
+         samples.size() / channels, channels);
+  return 0;
+}
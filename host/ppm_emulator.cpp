@@ -0,0 +1,328 @@
+// Эмулятор энкодера на псевдотерминале: нагрузочная проверка тракта
+// хост -> устройство без платы.
+//
+//   ppm_emulator [опции]
+//
+// Печатает путь к подчинённому pty, который открывается вместо
+// /dev/ttyACM*. Внутри - ядро прошивки (ppm_core.h): разбор потока,
+// команды, DSP, очередь отсчётов, выбор кода фрейма с простоем,
+// преамбулой и калибровкой. Своё у эмулятора только то, что в прошивке
+// делает железо: фреймы снимаются по часам хоста с периодом профиля
+// (в простое - с периодом фреймов поддержки), R меняет только таблицы
+// пауз, E, W и BENCH не поддерживаются. Из pty читается,
+// только когда очередь вместит порцию, - как в основном цикле прошивки,
+// поэтому противодавление у клиента такое же, как с настоящим портом.
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "ppm_core.h"
+#include "ppm_stream.h"
+#include "ppm_timing.h"
+
+namespace {
+
+constexpr size_t SAMPLE_QUEUE_SIZE = 1024;
+constexpr size_t READ_MAX = 256;
+
+struct Options {
+  uint32_t sys_mhz = 133;
+  double speed = 1.0;
+  const char *output = nullptr;
+  const char *link = nullptr;
+};
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+using ResponseBuffer = ppm::TextBuffer<512>;
+
+// Часы хоста для ядра энкодера; такты DSP здесь - наносекунды
+struct HostClock {
+  static uint32_t now_us() { return static_cast<uint32_t>(now_ns() / 1000); }
+  static uint32_t cycles() { return static_cast<uint32_t>(now_ns()); }
+  static uint32_t cycles_since(uint32_t start) { return cycles() - start; }
+};
+
+using EncoderCore = ppm::EncoderCore<SAMPLE_QUEUE_SIZE, HostClock>;
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+// Клиент может не читать эхо и ответы; лишнее pty отбрасывает сам
+void reply(int fd, const void *data, size_t len) {
+  ssize_t n = write(fd, data, len);
+  (void)n;
+}
+
+// Устройство для ppm::handle_command: ядро прошивки, фреймы по часам хоста
+class Emulator {
+public:
+  explicit Emulator(const Options &opt_)
+      : opt(opt_), encoder(opt_.sys_mhz * 1000) {
+    encoder.apply(ppm::default_config(), opt.sys_mhz * 1000);
+  }
+
+  // Приёмник StreamParser
+  size_t write(int16_t *buf, size_t count) { return encoder.write(buf, count); }
+  void mark() { encoder.mark(); }
+
+  // Снять с очереди фреймы, наступившие к моменту now; в простое фреймы
+  // поддержки идут реже, как в прошивке
+  void runFrames(uint64_t now) {
+    encoder.testUpdate();
+    while (now >= nextFrameNs) {
+      ppm::SampleQueue<SAMPLE_QUEUE_SIZE> &samples = encoder.getSamples();
+      uint32_t before = samples.readIndex();
+      // Фреймы снимаются пачками: задержку маркера и пробуждения ядро
+      // считает от момента, не раньше текущего (mark() видел now)
+      uint64_t at = nextFrameNs > now ? nextFrameNs : now;
+      uint16_t code = encoder.nextCode(static_cast<uint32_t>(at / 1000));
+      bool taken = samples.readIndex() != before;
+      bool from_queue = !encoder.wasKeepalive() && (taken || pendingRight);
+      pendingRight = encoder.getModulation() == ppm::Modulation::Tdm &&
+                     !encoder.wasKeepalive() && taken;
+      frames++;
+      if (from_queue)
+        emit(code);
+      uint64_t step = static_cast<uint64_t>(encoder.getFrameTicks() * 1000 /
+                                            opt.speed);
+      nextFrameNs += step ? step : 1;
+    }
+  }
+
+  EncoderCore &core() { return encoder; }
+
+  bool setModulation(ppm::Modulation m) {
+    if (!ppm::modulation_fits(encoder.getTiming().sys_khz, m))
+      return false;
+    if (m != encoder.getModulation()) {
+      encoder.applyModulation(m);
+      encoder.restartFeed();
+      pendingRight = false;
+    }
+    return true;
+  }
+
+  const char *encoderName() const { return "emulator"; }
+
+  void handleDevice(const ppm::Command &cmd, ResponseBuffer &response) {
+    if (cmd.id != ppm::CommandId::Reclock) {
+      response.str("\r\nНе поддерживается эмулятором\r\n");
+      return;
+    }
+    // Смена частоты меняет только таблицы пауз: период фрейма тот же
+    uint32_t mhz = cmd.ivalue > 0 ? static_cast<uint32_t>(cmd.ivalue) : 0;
+    if (ppm::is_clock_profile(mhz) &&
+        ppm::modulation_fits(mhz * 1000, encoder.getModulation())) {
+      encoder.retime(mhz * 1000);
+      encoder.restartFeed();
+      response.str("\r\nЧастота: ")
+          .num(mhz)
+          .str(" МГц, пауза вывода: 0 мкс\r\n");
+    } else {
+      response.str("\r\nНедопустимая частота: ").num(cmd.ivalue).str("\r\n");
+    }
+  }
+
+  void appendStats(ResponseBuffer &response) {
+    response.str(" frames=").num(static_cast<uint32_t>(frames));
+  }
+
+  size_t readSize() const { return encoder.getBufferProfile().read_size; }
+  uint8_t blockSize() const { return encoder.getBufferProfile().block_size; }
+  bool canRead() { return encoder.getSamples().space() >= readSize(); }
+  uint64_t getNextFrameNs() const { return nextFrameNs; }
+  void startClock(uint64_t now) { nextFrameNs = now; }
+
+  bool openOutput() {
+    if (!opt.output)
+      return true;
+    out = fopen(opt.output, "wb");
+    return out != nullptr;
+  }
+
+  void closeOutput() {
+    if (out)
+      fclose(out);
+    out = nullptr;
+  }
+
+private:
+  // Отсчёты, восстановленные из кодов, как их увидит приёмник: на месте
+  // преамбулы повторяется предыдущий
+  void emit(uint16_t code) {
+    if (!out)
+      return;
+    if (encoder.getModulation() == ppm::Modulation::Tdm) {
+      if (deinterleaver.push(code, held[0], held[1]))
+        fwrite(held, sizeof(int16_t), 2, out);
+      return;
+    }
+    if (code != ppm::SYNC_CODE) {
+      if (code >= ppm::MAX_CODE)
+        code = ppm::MAX_CODE - 1;
+      held[0] = ppm::code_to_pcm(code, ppm::MAX_CODE);
+    }
+    fwrite(held, sizeof(int16_t), 1, out);
+  }
+
+  const Options &opt;
+  EncoderCore encoder;
+  ppm::TdmDeinterleaver deinterleaver;
+  int16_t held[2] = {0, 0};
+  uint64_t nextFrameNs = 0;
+  uint64_t frames = 0;
+  bool pendingRight = false;
+  FILE *out = nullptr;
+};
+
+void usage() {
+  fprintf(stderr,
+          "Использование: ppm_emulator [опции]\n"
+          "  -s <МГц>     системная частота (133)\n"
+          "  -x <k>       ускорение частоты фреймов (1)\n"
+          "  -o <файл>    восстановленные отсчёты int16 LE\n"
+          "  -l <путь>    символическая ссылка на pty\n");
+}
+
+bool parse_options(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || i + 1 >= argc)
+      return false;
+    const char *value = argv[++i];
+    switch (arg[1]) {
+    case 's':
+      opt.sys_mhz = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+      break;
+    case 'x':
+      opt.speed = atof(value);
+      break;
+    case 'o':
+      opt.output = value;
+      break;
+    case 'l':
+      opt.link = value;
+      break;
+    default:
+      return false;
+    }
+  }
+  return ppm::is_clock_profile(opt.sys_mhz) && opt.speed > 0;
+}
+
+int open_pty(const Options &opt, int &slave) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    return -1;
+  const char *name = ptsname(master);
+  // Держим подчинённую сторону открытой, иначе без клиента чтение
+  // мастера возвращает EIO
+  slave = open(name, O_RDWR | O_NOCTTY);
+  struct termios tio;
+  if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+  }
+  if (opt.link) {
+    unlink(opt.link);
+    if (symlink(name, opt.link) != 0)
+      perror("symlink");
+  }
+  printf("%s\n", opt.link ? opt.link : name);
+  fflush(stdout);
+  return master;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parse_options(argc, argv, opt)) {
+    usage();
+    return 2;
+  }
+
+  Emulator emu(opt);
+  if (!emu.openOutput()) {
+    fprintf(stderr, "Не удалось создать %s\n", opt.output);
+    return 1;
+  }
+  int slave = -1;
+  int master = open_pty(opt, slave);
+  if (master < 0) {
+    perror("pty");
+    return 1;
+  }
+
+  int epfd = epoll_create1(0);
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = master;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, master, &ev);
+
+  std::signal(SIGINT, [](int) { stop_requested = 1; });
+  std::signal(SIGTERM, [](int) { stop_requested = 1; });
+
+  ppm::StreamParser<Emulator> parser(emu);
+  emu.startClock(now_ns());
+
+  while (!stop_requested) {
+    uint64_t now = now_ns();
+    emu.runFrames(now);
+    parser.setBlockSize(emu.blockSize());
+
+    // Как в прошивке: читаем, только если очередь примет порцию
+    int timeout_ms = 1;
+    if (emu.canRead()) {
+      struct epoll_event out;
+      if (epoll_wait(epfd, &out, 1, timeout_ms) <= 0)
+        continue;
+      uint8_t buf[READ_MAX];
+      uint8_t echo[READ_MAX];
+      size_t echo_len = 0;
+      ssize_t count = read(master, buf, emu.readSize());
+      if (count < 0 && errno != EAGAIN && errno != EINTR)
+        break;
+      for (ssize_t i = 0; i < count; i++) {
+        ppm::InputResult r = parser.feed(buf[i]);
+        if (r.echo)
+          echo[echo_len++] = buf[i];
+        if (r.line) {
+          ResponseBuffer response;
+          reply(master, echo, echo_len);
+          echo_len = 0;
+          ppm::handle_line(emu, parser.line(), response);
+          reply(master, response.data(), response.size());
+          parser.clearLine();
+        }
+      }
+      if (echo_len > 0)
+        reply(master, echo, echo_len);
+    } else {
+      // Очередь полна: ждём, пока фреймы её разгрузят
+      uint64_t wake = emu.getNextFrameNs();
+      if (wake > now)
+        usleep(static_cast<useconds_t>(
+            std::min<uint64_t>((wake - now) / 1000 + 1, 1000)));
+    }
+  }
+
+  emu.closeOutput();
+  close(master);
+  if (slave >= 0)
+    close(slave);
+  return 0;
+}
@@ -0,0 +1,324 @@
+// Моделирование захвата приёмником, включившимся посреди потока.
+//
+//   ppm_locksim [опции]
+//
+// Энкодер моделируется как в прошивке: фрейм в период, преамбула раз в
+// interval фреймов на месте фрейма (на границе пары TDM), коды - шум во
+// всём диапазоне слота или, с -k, ровный звук: один код во всех фреймах
+// (в TDM - в обоих каналах). Ровный звук - худший случай: пара из
+// второго импульса и начала следующего фрейма повторяется с периодом и
+// может увести захват в чужую фазу. Приёмник (FrameDecoder с
+// настройками прошивки) включается в случайный момент потока; импульсы
+// теряются с вероятностью -d, между ними появляются ложные (-e на
+// фрейм), моменты дрожат на -t тактов. Для каждого периода преамбулы
+// выводятся доля фреймов под преамбулу и время от включения до захвата.
+// Код возврата 1, если был захват в чужой фазе, включение без захвата
+// или захват дольше -b мкс.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "ppm_audio.h"
+#include "ppm_decoder.h"
+#include "ppm_timing.h"
+
+namespace {
+
+struct Options {
+  uint32_t sys_mhz = 133;
+  ppm::Modulation modulation = ppm::Modulation::Mono;
+  unsigned trials = 2000;
+  uint32_t observe_frames = 4096;
+  double drop = 0;
+  double spurious = 0;
+  uint32_t jitter = 0;
+  int32_t steady = -1; // код ровного звука, -1 - шум
+  double bound_us = 1000;
+  uint64_t seed = 1;
+  std::vector<uint32_t> intervals{0, 8, 16, 32, 64, 128, 256};
+};
+
+void usage() {
+  fprintf(stderr,
+          "Использование: ppm_locksim [опции]\n"
+          "  -s <МГц>     системная частота энкодера (133)\n"
+          "  -m mono|tdm  модуляция (mono)\n"
+          "  -i <n>[,n]   периоды преамбулы во фреймах, 0 - без неё\n"
+          "               (0,8,16,32,64,128,256)\n"
+          "  -n <n>       включений приёмника на период (2000)\n"
+          "  -w <n>       фреймов наблюдения после включения (4096)\n"
+          "  -d <p>       вероятность потери импульса (0)\n"
+          "  -e <n>       ложных импульсов на фрейм (0)\n"
+          "  -t <такты>   дрожание моментов импульсов (0)\n"
+          "  -k <код>     ровный звук: код 0..1023 во всех фреймах\n"
+          "  -b <мкс>     предельное время захвата (1000)\n"
+          "  -x <n>       зерно генератора (1)\n");
+}
+
+bool parse_options(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || i + 1 >= argc)
+      return false;
+    const char *value = argv[++i];
+    switch (arg[1]) {
+    case 's':
+      opt.sys_mhz = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+      break;
+    case 'm':
+      if (strcmp(value, "mono") == 0)
+        opt.modulation = ppm::Modulation::Mono;
+      else if (strcmp(value, "tdm") == 0)
+        opt.modulation = ppm::Modulation::Tdm;
+      else
+        return false;
+      break;
+    case 'i': {
+      opt.intervals.clear();
+      char *end = const_cast<char *>(value);
+      do {
+        uint32_t n = static_cast<uint32_t>(strtoul(end, &end, 10));
+        if (n != 0 && (n < ppm::SYNC_MIN_INTERVAL || n > UINT16_MAX))
+          return false;
+        opt.intervals.push_back(n);
+      } while (*end++ == ',');
+      break;
+    }
+    case 'n':
+      opt.trials = static_cast<unsigned>(strtoul(value, nullptr, 10));
+      break;
+    case 'w':
+      opt.observe_frames = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+      break;
+    case 'd':
+      opt.drop = strtod(value, nullptr);
+      break;
+    case 'e':
+      opt.spurious = strtod(value, nullptr);
+      break;
+    case 't':
+      opt.jitter = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+      break;
+    case 'k': {
+      char *end = nullptr;
+      unsigned long code = strtoul(value, &end, 10);
+      if (*end != '\0' || code >= ppm::MAX_CODE)
+        return false;
+      opt.steady = static_cast<int32_t>(code);
+      break;
+    }
+    case 'b':
+      opt.bound_us = strtod(value, nullptr);
+      break;
+    case 'x':
+      opt.seed = strtoull(value, nullptr, 10);
+      break;
+    default:
+      return false;
+    }
+  }
+  return ppm::is_clock_profile(opt.sys_mhz) &&
+         ppm::modulation_fits(opt.sys_mhz * 1000, opt.modulation) &&
+         opt.trials > 0 && opt.observe_frames > 0 && opt.drop >= 0 &&
+         opt.drop < 1 && opt.spurious >= 0 && opt.bound_us > 0;
+}
+
+// Переданный фрейм: начало и код (SYNC_CODE для преамбулы)
+struct SentFrame {
+  uint32_t start;
+  uint16_t code;
+};
+
+struct TrialResult {
+  bool locked = false;
+  bool by_sync = false;
+  bool wrong = false; // захват не на первом импульсе фрейма
+  uint32_t lock_cycles = 0;
+};
+
+class Simulator {
+public:
+  Simulator(const Options &opt_, const ppm::TimingProfile &timing_)
+      : opt(opt_), timing(timing_), cfg(ppm::make_decoder_config(timing_)),
+        rng(opt_.seed) {}
+
+  TrialResult run(uint32_t interval) {
+    const uint32_t period = timing.frame_cycles;
+    // Включение - в случайном фрейме первых двух периодов преамбулы
+    uint32_t span = 2 * std::max<uint32_t>(interval, 64);
+    uint32_t join_frame = uniform(span);
+    uint32_t join = join_frame * period + uniform(period);
+    uint32_t total = join_frame + opt.observe_frames + 1;
+
+    // Поток энкодера от начала: счётчик преамбулы как в nextGap
+    sent.clear();
+    pulses.clear();
+    uint32_t sync_count = 0;
+    for (uint32_t k = 0; k < total; k++) {
+      uint16_t code = frameCode(k);
+      uint32_t gap = ppm::code_gap(timing, code);
+      if (interval != 0 && ++sync_count >= interval && k % 2 == 0) {
+        sync_count = 0;
+        code = ppm::SYNC_CODE;
+        gap = ppm::sync_gap(timing);
+      }
+      uint32_t start = k * period;
+      sent.push_back(SentFrame{start, code});
+      addPulse(start + shake(), join);
+      addPulse(start + gap + shake(), join);
+      // Ложные импульсы: в среднем -e на фрейм
+      for (uint32_t n = poisson(); n > 0; n--)
+        addPulse(start + uniform(period), join);
+    }
+    std::sort(pulses.begin(), pulses.end());
+
+    TrialResult result;
+    ppm::FrameDecoder decoder(cfg);
+    for (uint32_t t : pulses) {
+      ppm::Frame frame;
+      bool emitted = decoder.push(t, frame);
+      if (!result.locked && decoder.isLocked()) {
+        result.locked = true;
+        result.by_sync = decoder.getStats().sync_locks > 0;
+        result.wrong = emitted && !matches(frame);
+        result.lock_cycles = t - join;
+        break;
+      }
+    }
+    return result;
+  }
+
+private:
+  // Код фрейма k; в TDM чётные фреймы - левый слот
+  uint16_t frameCode(uint32_t k) {
+    const bool tdm = opt.modulation == ppm::Modulation::Tdm;
+    const ppm::TdmSlot slot =
+        k % 2 == 0 ? ppm::TdmSlot::Left : ppm::TdmSlot::Right;
+    if (opt.steady >= 0) {
+      uint16_t code = static_cast<uint16_t>(opt.steady);
+      return tdm ? ppm::tdm_slot_code(code, slot) : code;
+    }
+    if (!tdm)
+      return static_cast<uint16_t>(uniform(ppm::MAX_CODE));
+    return static_cast<uint16_t>(
+        uniform(ppm::TDM_SLOT_RANGE) +
+        (slot == ppm::TdmSlot::Left ? ppm::TDM_SLOT_RANGE : 0));
+  }
+
+  uint32_t uniform(uint32_t n) {
+    return std::uniform_int_distribution<uint32_t>(0, n - 1)(rng);
+  }
+
+  int32_t shake() {
+    if (opt.jitter == 0)
+      return 0;
+    int32_t j = static_cast<int32_t>(opt.jitter);
+    return std::uniform_int_distribution<int32_t>(-j, j)(rng);
+  }
+
+  uint32_t poisson() {
+    if (opt.spurious <= 0)
+      return 0;
+    return std::poisson_distribution<uint32_t>(opt.spurious)(rng);
+  }
+
+  void addPulse(uint32_t t, uint32_t join) {
+    if (t < join)
+      return;
+    if (opt.drop > 0 &&
+        std::uniform_real_distribution<double>(0, 1)(rng) < opt.drop)
+      return;
+    pulses.push_back(t);
+  }
+
+  // Фрейм захвата начинается с первого импульса переданного. Код не
+  // сверяется: ложный импульс внутри фрейма портит код и в захвате
+  bool matches(const ppm::Frame &frame) const {
+    const uint32_t period = timing.frame_cycles;
+    uint32_t k = (frame.start + period / 2) / period;
+    if (k >= sent.size())
+      return false;
+    int32_t offset = static_cast<int32_t>(frame.start - sent[k].start);
+    return offset >= -static_cast<int32_t>(cfg.tolerance) &&
+           offset <= static_cast<int32_t>(cfg.tolerance);
+  }
+
+  const Options &opt;
+  ppm::TimingProfile timing;
+  ppm::DecoderConfig cfg;
+  std::mt19937_64 rng;
+  std::vector<SentFrame> sent;
+  std::vector<uint32_t> pulses;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parse_options(argc, argv, opt)) {
+    usage();
+    return 2;
+  }
+
+  const ppm::TimingProfile timing = ppm::make_timing_profile(
+      opt.sys_mhz * 1000, ppm::modulation_slots(opt.modulation));
+  const double cycles_per_us = opt.sys_mhz;
+  const bool fits = ppm::sync_fits(timing);
+  printf("profile: %u MHz %s, period %u cycles, codes %u..%u, sync_gap %u%s\n",
+         opt.sys_mhz,
+         opt.modulation == ppm::Modulation::Tdm ? "tdm" : "mono",
+         timing.frame_cycles, ppm::min_gap(timing), ppm::max_gap(timing),
+         ppm::sync_gap(timing), fits ? "" : " (does not fit, preamble off)");
+  printf("trials %u, drop %.3f, spurious %.3f/frame, jitter %u cycles\n",
+         opt.trials, opt.drop, opt.spurious, opt.jitter);
+  if (opt.steady >= 0)
+    printf("steady code %d\n", opt.steady);
+  else
+    printf("random codes\n");
+  printf("%8s %9s %10s %10s %10s %10s %7s %8s\n", "interval", "overhead",
+         "mean_us", "p50_us", "p99_us", "max_us", "wrong", "timeout");
+
+  Simulator sim(opt, timing);
+  std::vector<uint32_t> lock;
+  bool ok = true;
+  for (uint32_t interval : opt.intervals) {
+    if (interval != 0 && !fits)
+      continue;
+    lock.clear();
+    unsigned wrong = 0, timeouts = 0, by_sync = 0;
+    for (unsigned n = 0; n < opt.trials; n++) {
+      TrialResult r = sim.run(interval);
+      if (!r.locked) {
+        timeouts++;
+        continue;
+      }
+      lock.push_back(r.lock_cycles);
+      wrong += r.wrong;
+      by_sync += r.by_sync;
+    }
+    std::sort(lock.begin(), lock.end());
+    double mean = 0;
+    for (uint32_t c : lock)
+      mean += c;
+    mean = lock.empty() ? 0 : mean / lock.size();
+    auto pct = [&](double p) {
+      return lock.empty() ? 0.0
+                          : lock[static_cast<size_t>(p * (lock.size() - 1))] /
+                                cycles_per_us;
+    };
+    printf("%8u %8.2f%% %10.1f %10.1f %10.1f %10.1f %7u %8u", interval,
+           interval ? 100.0 / interval : 0.0, mean / cycles_per_us, pct(0.5),
+           pct(0.99), pct(1.0), wrong, timeouts);
+    if (interval != 0)
+      printf("  sync_locks=%u", by_sync);
+    // Захват в чужой фазе при ровном звуке не исправляется сам
+    bool pass = wrong == 0 && timeouts == 0 && pct(1.0) <= opt.bound_us;
+    printf("%s\n", pass ? "" : "  FAIL");
+    ok &= pass;
+  }
+  printf("%s (bound %.0f us)\n", ok ? "OK" : "FAIL", opt.bound_us);
+  return ok ? 0 : 1;
+}
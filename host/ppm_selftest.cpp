@@ -0,0 +1,158 @@
+// Проверки общих заголовков прошивки на ПК.
+//
+//   ppm_selftest [проверка...]
+//
+// Без аргументов выполняются все проверки. Заголовки, которым нужен
+// Pico SDK, собираются с заглушками из host/stub. Код возврата 1, если
+// хоть одна проверка не прошла.
+#include <cstdio>
+#include <cstring>
+
+#include "ppm_config.h"
+#include "ppm_core.h"
+#include "ppm_decoder.h"
+#include "ppm_encoders.h"
+
+namespace {
+
+bool failed = false;
+
+void expect(bool ok, const char *what) {
+  if (!ok) {
+    printf("  FAIL: %s\n", what);
+    failed = true;
+  }
+}
+
+// Переключения программ энкодера при нехватке памяти PIO: выбранная
+// загружается, активная остаётся на месте
+void check_encoders() {
+  pio_hw_t hw;
+  ppm::EncoderRegistry encoders;
+  encoders.init(&hw);
+  expect(encoders.isLoaded(0) && encoders.isLoaded(1) &&
+             !encoders.isLoaded(2),
+         "init loads what fits");
+
+  // Активная ppm, загружены ppm и pulse: для framed выгружается pulse,
+  // последняя в списке
+  expect(encoders.ensure(2, 0), "pulse over framed");
+  expect(encoders.ensure(1, 0), "framed after evicting the last program");
+
+  uint active = 1;
+  for (uint n = 0; n < 64; n++) {
+    uint index = (active + 1 + n % 2) % ppm::ENCODER_COUNT;
+    uint offset = encoders.offset(active);
+    bool ok = encoders.ensure(index, active);
+    expect(ok && encoders.isLoaded(index), "switch loads the program");
+    expect(encoders.isLoaded(active) && encoders.offset(active) == offset,
+           "active program stays in place");
+    active = index;
+  }
+}
+
+// Коды слотов TDM у краёв шкалы, включая MAX_CODE от интервала max_gap
+void check_tdm() {
+  constexpr uint16_t R = ppm::TDM_SLOT_RANGE;
+  constexpr int16_t top = ppm::code_to_pcm(R - 1, R);
+  constexpr int16_t bottom = ppm::code_to_pcm(0, R);
+  struct Case {
+    uint16_t left_code, right_code;
+    int16_t left, right;
+  };
+  const Case cases[] = {
+      {ppm::MAX_CODE, 0, top, bottom},
+      {ppm::MAX_CODE - 1, R - 1, top, top},
+      {R, R - 1, bottom, top},
+  };
+  ppm::TdmDeinterleaver tdm;
+  for (const Case &c : cases) {
+    int16_t left = 0, right = 0;
+    bool ok = !tdm.push(c.left_code, left, right) &&
+              tdm.push(c.right_code, left, right);
+    expect(ok, "pair assembled");
+    expect(left == c.left && right == c.right, "slots keep their sign");
+  }
+  expect(tdm.getOrphans() == 0, "no orphans");
+}
+
+// Часы ядра энкодера: время задают фреймы, такты DSP не нужны
+struct FakeClock {
+  static uint32_t now_us() { return 0; }
+  static uint32_t cycles() { return 0; }
+  static uint32_t cycles_since(uint32_t) { return 0; }
+};
+
+// Простой с настройками по умолчанию при пустой очереди (поток не идёт
+// или порт закрыт) и выход из него по громкому отсчёту
+void check_idle() {
+  ppm::EncoderCore<64, FakeClock> core(ppm::SAMPLE_PERIOD_BASE_KHZ);
+  core.apply(ppm::default_config(), ppm::SAMPLE_PERIOD_BASE_KHZ);
+  const uint32_t period = core.getTiming().frame_ticks;
+  uint32_t at = 0;
+  for (uint32_t n = 1; n < ppm::IDLE_DEFAULT_FRAMES; n++, at += period)
+    core.nextCode(at);
+  expect(!core.isIdle(), "no idle before the silent run");
+  core.nextCode(at);
+  at += period;
+  expect(core.isIdle(), "starved queue idles");
+  expect(core.nextCode(at) == ppm::IDLE_CODE && core.wasKeepalive(),
+         "keepalive frame");
+
+  const int16_t loud = 10000;
+  core.getSamples().write(&loud, 1);
+  expect(core.nextCode(at + period) == ppm::pcm_to_code(loud, ppm::MAX_CODE),
+         "loud sample wakes");
+  expect(!core.isIdle(), "awake");
+}
+
+// Преамбула, не помещающаяся во фрейм TDM, выключается сменой модуляции
+// и не попадает в запись флеша
+void check_sync() {
+  constexpr uint32_t khz = 250000;
+  ppm::EncoderCore<64, FakeClock> core(khz);
+  core.apply(ppm::default_config(), khz);
+  expect(core.setSync(16), "preamble fits mono");
+  core.applyModulation(ppm::Modulation::Tdm);
+  expect(!ppm::sync_fits(core.getTiming()), "preamble does not fit tdm");
+  expect(core.getSyncInterval() == 0, "tdm turns the preamble off");
+  expect(!core.setSync(16), "preamble refused in tdm");
+  ppm::DeviceConfig config = ppm::default_config();
+  config.sync_interval = 16;
+  core.capture(config);
+  expect(config.sync_interval == 0, "saved without the preamble");
+}
+
+struct Check {
+  const char *name;
+  void (*run)();
+};
+
+const Check CHECKS[] = {
+    {"encoders", check_encoders},
+    {"tdm", check_tdm},
+    {"idle", check_idle},
+    {"sync", check_sync},
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int run = 0;
+  for (const Check &c : CHECKS) {
+    bool selected = argc < 2;
+    for (int i = 1; i < argc; i++)
+      selected |= strcmp(argv[i], c.name) == 0;
+    if (!selected)
+      continue;
+    printf("%s\n", c.name);
+    c.run();
+    run++;
+  }
+  if (run == 0) {
+    fprintf(stderr, "Использование: ppm_selftest [проверка...]\n");
+    return 2;
+  }
+  printf("%s\n", failed ? "FAIL" : "OK");
+  return failed ? 1 : 0;
+}
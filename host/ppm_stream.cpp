@@ -0,0 +1,246 @@
+// Передача звука на энкодер через CDC-порт.
+//
+//   ppm_stream [опции] /dev/ttyACM0
+//
+// Источник - WAV 16 бит, синус или список кодов. Перед потоком можно
+// отправить команды (-c), после - запросить статистику устройства (-s).
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ppm_audio.h"
+#include "ppm_client.h"
+#include "ppm_timing.h"
+
+namespace {
+
+struct Options {
+  const char *port = nullptr;
+  const char *wav = nullptr;
+  const char *codes = nullptr;
+  double tone_hz = 0;
+  double duration = 5.0;
+  unsigned channels = 1;
+  size_t block_samples = 256;
+  size_t pool_blocks = 64;
+  uint32_t marker_interval = 0;
+  bool query_stats = false;
+  std::vector<const char *> commands;
+};
+
+void usage() {
+  fprintf(stderr,
+          "Использование: ppm_stream [опции] порт\n"
+          "  -w <файл>    WAV, 16 бит PCM (моно или стерео для tdm)\n"
+          "  -t <Гц>      синус вместо файла\n"
+          "  -d <с>       длительность синуса (5)\n"
+          "  -2           синус в двух каналах (для M:tdm)\n"
+          "  -k <файл>    коды 0..1023 по одному в строке\n"
+          "  -c <строка>  команда перед потоком, можно несколько\n"
+          "  -b <n>       отсчётов в блоке (256, не больше %zu)\n"
+          "  -n <n>       блоков в пуле (64)\n"
+          "  -m <n>       каждый n-й блок - метка задержки\n"
+          "  -s           запросить S после потока\n",
+          ppm::CLIENT_MAX_BLOCK_SAMPLES);
+}
+
+bool parse_options(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-') {
+      opt.port = arg;
+      continue;
+    }
+    if (strcmp(arg, "-2") == 0) {
+      opt.channels = 2;
+      continue;
+    }
+    if (strcmp(arg, "-s") == 0) {
+      opt.query_stats = true;
+      continue;
+    }
+    if (arg[2] != '\0' || i + 1 >= argc)
+      return false;
+    const char *value = argv[++i];
+    switch (arg[1]) {
+    case 'w':
+      opt.wav = value;
+      break;
+    case 't':
+      opt.tone_hz = atof(value);
+      break;
+    case 'd':
+      opt.duration = atof(value);
+      break;
+    case 'k':
+      opt.codes = value;
+      break;
+    case 'c':
+      opt.commands.push_back(value);
+      break;
+    case 'b':
+      opt.block_samples = strtoul(value, nullptr, 10);
+      break;
+    case 'n':
+      opt.pool_blocks = strtoul(value, nullptr, 10);
+      break;
+    case 'm':
+      opt.marker_interval = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+      break;
+    default:
+      return false;
+    }
+  }
+  return opt.port && opt.block_samples > 0 && opt.pool_blocks > 0 &&
+         (opt.wav || opt.codes || opt.tone_hz > 0);
+}
+
+uint32_t read_le(FILE *f, int bytes) {
+  uint32_t v = 0;
+  for (int i = 0; i < bytes; i++)
+    v |= static_cast<uint32_t>(fgetc(f) & 0xFF) << (8 * i);
+  return v;
+}
+
+// Найти блок data; файл остаётся на начале отсчётов
+bool open_wav(FILE *f, unsigned &channels) {
+  char tag[4];
+  if (fread(tag, 1, 4, f) != 4 || memcmp(tag, "RIFF", 4) != 0)
+    return false;
+  read_le(f, 4);
+  if (fread(tag, 1, 4, f) != 4 || memcmp(tag, "WAVE", 4) != 0)
+    return false;
+  bool have_fmt = false;
+  while (fread(tag, 1, 4, f) == 4) {
+    uint32_t size = read_le(f, 4);
+    if (memcmp(tag, "fmt ", 4) == 0) {
+      uint32_t format = read_le(f, 2);
+      channels = read_le(f, 2);
+      read_le(f, 4); // частота: устройство выводит с частотой фреймов
+      read_le(f, 4);
+      read_le(f, 2);
+      uint32_t bits = read_le(f, 2);
+      if (format != 1 || bits != 16 || channels < 1 || channels > 2)
+        return false;
+      fseek(f, size - 16 + (size & 1), SEEK_CUR);
+      have_fmt = true;
+    } else if (memcmp(tag, "data", 4) == 0) {
+      return have_fmt;
+    } else {
+      fseek(f, size + (size & 1), SEEK_CUR);
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parse_options(argc, argv, opt)) {
+    usage();
+    return 2;
+  }
+
+  ppm::StreamClient client(opt.pool_blocks, opt.block_samples);
+  client.setTextSink(
+      [](const char *data, size_t len) { fwrite(data, 1, len, stdout); });
+  client.setMarkerInterval(opt.marker_interval);
+  if (!client.open(opt.port)) {
+    fprintf(stderr, "Не удалось открыть %s\n", opt.port);
+    return 1;
+  }
+  for (const char *cmd : opt.commands) {
+    if (!client.command(cmd, 200)) {
+      fprintf(stderr, "Команда %s не отправлена\n", cmd);
+      return 1;
+    }
+  }
+
+  ppm::StreamClient::Source source;
+  FILE *wav = nullptr;
+  std::vector<int16_t> codes;
+  size_t position = 0;
+  if (opt.wav) {
+    unsigned channels = 1;
+    wav = fopen(opt.wav, "rb");
+    if (!wav || !open_wav(wav, channels)) {
+      fprintf(stderr, "Не удалось прочитать WAV %s\n", opt.wav);
+      return 1;
+    }
+    // Блоки не должны разрывать пару L,R
+    size_t frame = channels;
+    source = [wav, frame](int16_t *dst, size_t max) {
+      return fread(dst, sizeof(int16_t), max / frame * frame, wav);
+    };
+  } else if (opt.codes) {
+    FILE *f = fopen(opt.codes, "r");
+    if (!f) {
+      fprintf(stderr, "Не удалось открыть %s\n", opt.codes);
+      return 1;
+    }
+    unsigned code;
+    while (fscanf(f, "%u", &code) == 1) {
+      if (code >= ppm::MAX_CODE)
+        code = ppm::MAX_CODE - 1;
+      // Середина интервала кода переводится устройством обратно в тот же код
+      codes.push_back(ppm::code_to_pcm(static_cast<uint16_t>(code), ppm::MAX_CODE));
+    }
+    fclose(f);
+    source = [&codes, &position](int16_t *dst, size_t max) {
+      size_t n = std::min(max, codes.size() - position);
+      memcpy(dst, codes.data() + position, n * sizeof(int16_t));
+      position += n;
+      return n;
+    };
+  } else {
+    // Отсчёты уходят с частотой фреймов энкодера; период фрейма от
+    // профиля частоты не зависит, только от числа слотов на отсчёт
+    const double rate = ppm::sample_rate(ppm::make_timing_profile(
+        ppm::SAMPLE_PERIOD_BASE_KHZ, opt.channels));
+    const size_t total = static_cast<size_t>(opt.duration * rate);
+    const unsigned channels = opt.channels;
+    const double step = 2 * M_PI * opt.tone_hz / rate;
+    source = [&position, total, channels, step](int16_t *dst, size_t max) {
+      size_t n = 0;
+      for (; n + channels <= max && position < total; position++) {
+        int16_t s = static_cast<int16_t>(26000 * std::sin(step * position));
+        for (unsigned c = 0; c < channels; c++)
+          dst[n++] = s;
+      }
+      return n;
+    };
+  }
+
+  bool ok = client.run(source);
+  if (wav)
+    fclose(wav);
+  if (ok && opt.query_stats)
+    client.command("S", 300);
+
+  const ppm::ClientStats &st = client.getStats();
+  double seconds = st.elapsed_ns / 1e9;
+  printf("\nsent: %llu samples, %llu blocks (%llu markers), %llu bytes, %.3f s\n",
+         static_cast<unsigned long long>(st.samples_sent),
+         static_cast<unsigned long long>(st.blocks_sent),
+         static_cast<unsigned long long>(st.markers_sent),
+         static_cast<unsigned long long>(st.bytes_sent), seconds);
+  if (seconds > 0) {
+    printf("throughput: %.1f kB/s, %.0f samples/s\n",
+           st.bytes_sent / 1e3 / seconds, st.samples_sent / seconds);
+    printf("backpressure: would_block=%llu of %llu writes, blocked %.1f%% of time\n",
+           static_cast<unsigned long long>(st.would_block),
+           static_cast<unsigned long long>(st.write_calls),
+           100.0 * st.blocked_ns / st.elapsed_ns);
+  }
+  printf("pool: high water %zu of %zu blocks\n", st.pool_high_water,
+         opt.pool_blocks);
+  if (!ok) {
+    fprintf(stderr, "Ошибка порта\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,47 @@
+// Заглушка hardware/pio.h для проверок на ПК: только память инструкций
+// PIO (32 слота) и загрузка программ, как в Pico SDK.
+#pragma once
+
+#include <cstdint>
+
+typedef unsigned int uint;
+
+struct pio_program_t {
+  const uint16_t *instructions;
+  uint8_t length;
+  int8_t origin;
+};
+
+struct pio_hw_t {
+  uint32_t used_mask = 0; // занятые слоты памяти инструкций
+};
+
+typedef pio_hw_t *PIO;
+
+constexpr uint PIO_INSTRUCTION_COUNT = 32;
+
+// Первое место с конца памяти, как у pio_add_program; -1 - нет места
+inline int pio_find_offset(PIO pio, const pio_program_t *program) {
+  uint32_t mask = (1u << program->length) - 1;
+  for (int offset = PIO_INSTRUCTION_COUNT - program->length; offset >= 0;
+       offset--) {
+    if (!(pio->used_mask & (mask << offset)))
+      return offset;
+  }
+  return -1;
+}
+
+inline bool pio_can_add_program(PIO pio, const pio_program_t *program) {
+  return pio_find_offset(pio, program) >= 0;
+}
+
+inline uint pio_add_program(PIO pio, const pio_program_t *program) {
+  int offset = pio_find_offset(pio, program);
+  pio->used_mask |= ((1u << program->length) - 1) << offset;
+  return static_cast<uint>(offset);
+}
+
+inline void pio_remove_program(PIO pio, const pio_program_t *program,
+                               uint offset) {
+  pio->used_mask &= ~(((1u << program->length) - 1) << offset);
+}
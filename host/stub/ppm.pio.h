@@ -0,0 +1,14 @@
+// Заглушка ppm.pio.h для проверок на ПК. Длины программ завышены: все
+// три вместе не помещаются в 32 слота, и EncoderRegistry приходится
+// выгружать неактивные (с настоящими программами это не происходит).
+#pragma once
+
+#include "hardware/pio.h"
+
+inline const pio_program_t ppm_program = {nullptr, 12, -1};
+inline const pio_program_t ppm_framed_program = {nullptr, 12, -1};
+inline const pio_program_t ppm_pulse_program = {nullptr, 12, -1};
+
+inline void ppm_program_init(PIO, uint, uint, uint, float) {}
+inline void ppm_framed_program_init(PIO, uint, uint, uint, float) {}
+inline void ppm_pulse_program_init(PIO, uint, uint, uint, float) {}
@@ -1,158 +1,362 @@
-#include <cstdlib>
+#include <cstdint>
 #include <cstring>
-#include <iostream>
-#include <string>
 
 #include "hardware/clocks.h"
+#include "hardware/flash.h"
 #include "hardware/irq.h"
 #include "hardware/pio.h"
+#include "hardware/structs/systick.h"
 #include "hardware/structs/timer.h"
+#include "hardware/sync.h"
 #include "hardware/timer.h"
+#include "hardware/vreg.h"
 #include "pico/stdlib.h"
 #include <bsp/board_api.h>
 #include <pico/stdio.h>
 #include <tusb.h>
 
 #include "ppm.pio.h"
+#include "ppm_audio.h"
+#include "ppm_bench.h"
+#include "ppm_command.h"
+#include "ppm_config.h"
+#include "ppm_core.h"
+#include "ppm_encoders.h"
+#include "ppm_stream.h"
+#include "ppm_timing.h"
 
 #define LED_TIME 500
-#define MAX_CODE 1024
+// Частота при старте, если во флеше нет конфигурации;
+// во время работы меняется командой R:<МГц>
 #define SYS_FREQ 133000
-// #define SYS_FREQ 250000
-class PPMController {
-public:
-  static constexpr float MIN_PULSE_PERIOD_US = 3.0f;    // 3.0 microseconds
-  static constexpr float PIO_FREQ = SYS_FREQ * 1000.0f; // 133000000.0f;
-  static constexpr uint16_t MIN_INTERVAL_CYCLES =
-      MIN_PULSE_PERIOD_US * (SYS_FREQ / 1000);
-  static constexpr float AUDIO_SAMPLE_RATE = 48000.0f; // 50 kHz
-  static constexpr uint32_t AUDIO_FRAME_TICKS =
-      SYS_FREQ * 10.0 / AUDIO_SAMPLE_RATE;
+// Два последних сектора флеша под конфигурацию
+#define CONFIG_FLASH_OFFSET                                                    \
+  (PICO_FLASH_SIZE_BYTES - 2 * ppm::CONFIG_SECTOR_SIZE)
+// Максимальное ожидание опустошения FIFO при смене частоты и программы
+#define RECLOCK_DRAIN_TIMEOUT_US 1000
+#define SWITCH_DRAIN_TIMEOUT_US 1000
+// Очередь отсчётов PCM из CDC (степень двойки)
+#define SAMPLE_QUEUE_SIZE 1024
+// Наибольшая порция чтения из CDC среди профилей буферизации
+#define CDC_READ_MAX 256
+// Максимальное ожидание места в буфере CDC для ответа
+#define CDC_WRITE_TIMEOUT_US 100000
+
+// Время ядра энкодера: таймер в микросекундах и SysTick от clk_sys
+struct PicoClock {
+  static uint32_t now_us() { return timer_hw->timerawl; }
+  static uint32_t cycles() { return systick_hw->cvr; }
+  // SysTick считает вниз, 24 бита
+  static uint32_t cycles_since(uint32_t start) {
+    return (start - systick_hw->cvr) & 0x00FFFFFF;
+  }
+};
+
+using EncoderCore = ppm::EncoderCore<SAMPLE_QUEUE_SIZE, PicoClock>;
 
+class PPMController {
 private:
   static constexpr uint8_t PPM_PIN = 0;
 
   PIO pio;
   uint sm;
-  uint16_t currentCode;
-  bool testMode;
-  int8_t testDirection;
-  uint32_t testOutputCounter;
-  uint32_t testUpdateCounter;
-  float testUpdatePeriodSeconds;
-  uint32_t audio_sample_ticks;
+  ppm::EncoderRegistry encoders;
+  uint encoder;
+  EncoderCore core;
+  uint32_t frameTarget; // момент последнего будильника фрейма, мкс
 
 public:
   PPMController()
-      : pio(nullptr), sm(0), currentCode(0), testMode(false), testDirection(1),
-        testOutputCounter(0), testUpdateCounter(0),
-        testUpdatePeriodSeconds(0.001f) {}
+      : pio(nullptr), sm(0), encoder(0), core(SYS_FREQ), frameTarget(0) {}
 
-  void init() {
+  void init(const ppm::DeviceConfig &config) {
     pio = pio0;
     sm = 0;
-    uint offset = pio_add_program(pio, &ppm_program);
-    ppm_program_init(pio, sm, offset, PPM_PIN, PIO_FREQ);
+    encoders.init(pio);
+    encoder = config.encoder < ppm::ENCODER_COUNT &&
+                      encoders.ensure(config.encoder, 0)
+                  ? config.encoder
+                  : 0;
+
+    // SysTick от clk_sys считает такты обработки блоков DSP
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;
+
+    core.apply(config, clock_get_hz(clk_sys) / 1000);
+    const ppm::EncoderProgram &program = ppm::ENCODER_PROGRAMS[encoder];
+    program.init(pio, sm, encoders.offset(encoder), PPM_PIN,
+                 core.getTiming().pio_freq);
   }
 
-  void sendCode(uint16_t code) {
-    if (code > MAX_CODE)
-      code = MAX_CODE;
-    currentCode = code;
+  // Текущее состояние в виде записи для флеша
+  void captureConfig(ppm::DeviceConfig &config) const {
+    config.sys_mhz = core.getTiming().sys_khz / 1000;
+    config.encoder = encoder;
+    core.capture(config);
   }
 
-  void test_mode_update() {
-    static absolute_time_t next_test_update_time = {0};
-    if (testMode) {
-      if (absolute_time_diff_us(get_absolute_time(), next_test_update_time) <=
-          0) {
+  EncoderCore &getCore() { return core; }
+  const EncoderCore &getCore() const { return core; }
+  bool isIdle() const { return core.isIdle(); }
+  uint32_t getFrameTicks() const { return core.getFrameTicks(); }
 
-        currentCode += testDirection;
+  // Пауза следующего фрейма (EncoderCore::nextGap). ahead_us - через
+  // сколько фрейм выйдет на пин (слова впереди в FIFO)
+  uint32_t nextGap(uint32_t ahead_us = 0) {
+    return core.nextGap(timer_hw->timerawl + ahead_us);
+  }
 
-        if (currentCode >= MAX_CODE - 1) {
-          currentCode = MAX_CODE - 1;
-          testDirection = -1;
-        } else if (currentCode <= 1) {
-          currentCode = 1;
-          testDirection = 1;
-        }
-        int update_ms = (int)(testUpdatePeriodSeconds * 1000.0f);
-        next_test_update_time = make_timeout_time_ms(update_ms);
-      }
-    } else {
-      next_test_update_time = get_absolute_time();
+  // Слово ppm_framed для фрейма, код которого только что выбран
+  uint32_t framedWord(uint32_t gap) const {
+    return ppm_framed_word(gap, core.getFrameCycles());
+  }
+
+  // Будильник фрейма (TIMER_IRQ_0). Следующий ставится сразу и от цели
+  // прошлого, а не от момента обработки: время обработчика не сдвигает
+  // сетку фреймов
+  void onFrameAlarm() {
+    const uint32_t start = frameTarget;
+    const uint32_t ticks = getFrameTicks();
+    armFrame(start + ticks);
+    onFrameTimer(start);
+    // Фрейм, на котором начался или кончился простой, меняет период
+    if (getFrameTicks() != ticks)
+      armFrame(start + getFrameTicks());
+  }
+
+  // Пропущенные моменты не наверстываются, как в FeedBench
+  void armFrame(uint32_t target) {
+    while ((int32_t)(target - timer_hw->timerawl) < 2)
+      target += getFrameTicks();
+    frameTarget = target;
+    timer_hw->alarm[0] = target;
+  }
+
+  // Начало фрейма по таймеру; start_us - момент будильника
+  void onFrameTimer(uint32_t start_us) {
+    switch (ppm::ENCODER_PROGRAMS[encoder].feed) {
+    case ppm::EncoderFeed::Timer:
+      pio_sm_put(pio, sm, ppm_word(nextGap()));
+      break;
+    case ppm::EncoderFeed::CpuPulse: {
+      // Оба импульса - по будильникам от одного момента, поэтому задержка
+      // обработчика в паузу не входит
+      pio_sm_put(pio, sm, 1);
+      uint32_t second =
+          start_us + ppm::pulse_gap_us(core.getTiming(), nextGap());
+      if ((int32_t)(second - timer_hw->timerawl) < 2)
+        pio_sm_put(pio, sm, 1);
+      else
+        timer_hw->alarm[1] = second;
+      break;
+    }
+    case ppm::EncoderFeed::SelfTimed:
+      onKeepaliveTick();
+      break;
     }
   }
 
-  bool parseCommand(const std::string &cmd, uint16_t &code) {
-    // Команда тест (T/t)
-    if (cmd.length() == 1 && (cmd[0] == 'T' || cmd[0] == 't')) {
-      testMode = !testMode;
+  // Простой самотактируемой программы: прерывание "TX не полон" держало бы
+  // FIFO полным фреймами поддержки и отодвигало пробуждение, поэтому слова
+  // по одному подаёт таймер раз в период фрейма поддержки
+  void startKeepaliveTimer() {
+    pio_set_irq0_source_enabled(
+        pio, pio_get_tx_fifo_not_full_interrupt_source(sm), false);
+    timer_hw->intr = 1u << 0;
+    armFrame(timer_hw->timerawl + getFrameTicks());
+    irq_set_enabled(TIMER_IRQ_0, true);
+  }
 
-      if (testMode) {
-        // При включении тестового режима сбросить счетчики
-        currentCode = 0;
-        testDirection = 1;
-        testUpdateCounter = 0;
-      }
+  void onKeepaliveTick() {
+    if (pio_sm_is_tx_fifo_full(pio, sm))
+      return;
+    // В FIFO слова фреймов поддержки
+    uint32_t ahead_us = pio_sm_get_tx_fifo_level(pio, sm) * getFrameTicks();
+    pio_sm_put(pio, sm, framedWord(nextGap(ahead_us)));
+    if (!core.isIdle()) {
+      irq_set_enabled(TIMER_IRQ_0, false);
+      pio_set_irq0_source_enabled(
+          pio, pio_get_tx_fifo_not_full_interrupt_source(sm), true);
+    }
+  }
 
-      code = testMode ? 1 : 0;
-      return true;
+  // Второй импульс в режиме CpuPulse (TIMER_IRQ_1)
+  void onSecondPulse() { pio_sm_put(pio, sm, 1); }
+
+  // Пополнение FIFO самотактируемой программы (PIO0_IRQ_0, TX не полон)
+  void onFifoNotFull() {
+    const uint32_t frame_ticks = core.getTiming().frame_ticks;
+    while (!pio_sm_is_tx_fifo_full(pio, sm)) {
+      uint32_t ahead_us = pio_sm_get_tx_fifo_level(pio, sm) * frame_ticks;
+      pio_sm_put(pio, sm, framedWord(nextGap(ahead_us)));
+      if (core.isIdle()) {
+        startKeepaliveTimer();
+        return;
+      }
     }
+  }
 
-    // Команда установки периода обновления в секундах (P:число или p:число)
-    if (cmd.length() >= 3 && (cmd[0] == 'P' || cmd[0] == 'p') &&
-        cmd[1] == ':') {
-      try {
-        float period = std::stof(cmd.substr(2));
-        setTestUpdatePeriod(period);
-        code = 0;
-        return true;
-      } catch (...) {
-        return false;
+  // Запустить подачу фреймов; первый фрейм начнётся в момент deadline
+  void startFeed(uint32_t deadline) {
+    core.restartFeed();
+    timer_hw->intr = (1u << 0) | (1u << 1);
+    if (ppm::ENCODER_PROGRAMS[encoder].feed == ppm::EncoderFeed::SelfTimed) {
+      while ((int32_t)(timer_hw->timerawl - deadline) < 0) {
+        tight_loop_contents();
       }
+      onFifoNotFull();
+      pio_set_irq0_source_enabled(
+          pio, pio_get_tx_fifo_not_full_interrupt_source(sm), true);
+    } else {
+      // Будильник срабатывает только при точном совпадении со счётчиком
+      if ((int32_t)(deadline - timer_hw->timerawl) < 2) {
+        deadline = timer_hw->timerawl + 2;
+      }
+      frameTarget = deadline;
+      timer_hw->alarm[0] = deadline;
+      irq_set_enabled(TIMER_IRQ_0, true);
+      irq_set_enabled(TIMER_IRQ_1, true);
+    }
+  }
+
+  // Остановить подачу и вернуть момент, когда должен начаться следующий фрейм
+  uint32_t stopFeed() {
+    irq_set_enabled(TIMER_IRQ_0, false);
+    // Второй импульс текущего фрейма должен успеть выйти
+    while (timer_hw->armed & (1u << 1)) {
+      tight_loop_contents();
     }
+    irq_set_enabled(TIMER_IRQ_1, false);
+    pio_set_irq0_source_enabled(
+        pio, pio_get_tx_fifo_not_full_interrupt_source(sm), false);
+    return frameTarget;
+  }
 
-    // Обработка команды кода (C:число или c:число)
-    if (cmd.length() >= 3 && (cmd[0] == 'C' || cmd[0] == 'c') &&
-        cmd[1] == ':') {
-      try {
-        code = std::stoi(cmd.substr(2));
-        return true;
-      } catch (...) {
+  // Дождаться, пока SM выведет все фреймы из FIFO и встанет на pull в
+  // начале программы, т.е. окажется на границе фрейма
+  bool waitFrameBoundary(uint32_t timeout_us) {
+    uint32_t start = time_us_32();
+    uint32_t stall_mask = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm);
+    while (!pio_sm_is_tx_fifo_empty(pio, sm)) {
+      if (time_us_32() - start > timeout_us)
         return false;
-      }
     }
+    pio->fdebug = stall_mask;
+    while (!(pio->fdebug & stall_mask) ||
+           pio_sm_get_pc(pio, sm) != encoders.offset(encoder)) {
+      if (time_us_32() - start > timeout_us)
+        return false;
+    }
+    return true;
+  }
 
-    return false;
+  // Остановить вывод на границе фрейма
+  uint32_t stop(uint32_t timeout_us) {
+    bool self_timed =
+        ppm::ENCODER_PROGRAMS[encoder].feed == ppm::EncoderFeed::SelfTimed;
+    uint32_t deadline = stopFeed();
+    waitFrameBoundary(timeout_us);
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_clear_fifos(pio, sm);
+    // Самотактируемая программа заканчивает фрейм ровно на границе
+    return self_timed ? timer_hw->timerawl : deadline;
+  }
+
+  // Пересчитать таблицы под текущую clk_sys и перезапустить SM
+  void resume() {
+    core.retime(clock_get_hz(clk_sys) / 1000);
+    const ppm::TimingProfile &timing = core.getTiming();
+    pio_sm_set_clkdiv(pio, sm, (float)clock_get_hz(clk_sys) / timing.pio_freq);
+    pio_sm_clkdiv_restart(pio, sm);
+    pio_sm_restart(pio, sm);
+    pio_sm_exec(pio, sm, pio_encode_jmp(encoders.offset(encoder)));
+    pio_sm_set_enabled(pio, sm, true);
+    startFeed(timer_hw->timerawl + timing.frame_ticks);
   }
 
-  void setTestUpdatePeriod(float seconds) {
-    if (seconds > 0.01f) {
-      testUpdatePeriodSeconds = seconds;
-      testUpdateCounter = 0;
+  // Переключить PIO-программу на границе фрейма, сохранив сетку фреймов
+  bool selectEncoder(uint index) {
+    if (index >= ppm::ENCODER_COUNT)
+      return false;
+    if (index == encoder)
+      return true;
+    if (!encoders.ensure(index, encoder))
+      return false;
+
+    uint32_t deadline = stop(SWITCH_DRAIN_TIMEOUT_US);
+    encoder = index;
+    const ppm::EncoderProgram &program = ppm::ENCODER_PROGRAMS[encoder];
+    program.init(pio, sm, encoders.offset(encoder), PPM_PIN,
+                 core.getTiming().pio_freq);
+    startFeed(deadline);
+    return true;
+  }
+
+  // Смена модуляции меняет период фрейма, поэтому вывод перезапускается.
+  // false, если фрейм модуляции не помещается при текущей частоте
+  bool setModulation(ppm::Modulation m) {
+    if (!ppm::modulation_fits(core.getTiming().sys_khz, m))
+      return false;
+    if (m == core.getModulation())
+      return true;
+    stop(SWITCH_DRAIN_TIMEOUT_US);
+    core.applyModulation(m);
+    resume();
+    return true;
+  }
+
+  // Замер пределов подачи: SM отдаётся стенду, затем программа энкодера
+  // запускается заново с новой сеткой фреймов
+  template <typename Report, typename Idle>
+  void bench(Report &&report, Idle &&idle, uint32_t *best) {
+    int ppm_index = ppm::EncoderRegistry::find("ppm", 3);
+    int framed_index = ppm::EncoderRegistry::find("framed", 6);
+    const ppm::TimingProfile &timing = core.getTiming();
+    stop(SWITCH_DRAIN_TIMEOUT_US);
+    if (encoders.ensure(ppm_index, encoder) &&
+        encoders.ensure(framed_index, ppm_index)) {
+      ppm::FeedBench bench(pio, sm, PPM_PIN, encoders.offset(ppm_index),
+                           encoders.offset(framed_index), timing.sys_khz);
+      bench.run(report, idle);
+      for (size_t f = 0; f < ppm::BENCH_FEED_COUNT; f++)
+        best[f] = bench.getBest(static_cast<ppm::BenchFeed>(f));
     }
+    encoders.ensure(encoder, encoder);
+    const ppm::EncoderProgram &program = ppm::ENCODER_PROGRAMS[encoder];
+    program.init(pio, sm, encoders.offset(encoder), PPM_PIN, timing.pio_freq);
+    startFeed(timer_hw->timerawl + timing.frame_ticks);
   }
 
-  bool isTestMode() const { return testMode; }
-  uint16_t getCurrentCode() const { return currentCode; }
-  float getTestUpdatePeriod() const { return testUpdatePeriodSeconds; }
+  // Приёмник StreamParser
+  size_t write(int16_t *buf, size_t count) { return core.write(buf, count); }
+  void mark() { core.mark(); }
+
+  const ppm::EncoderProgram &getEncoder() const {
+    return ppm::ENCODER_PROGRAMS[encoder];
+  }
 };
 
 // Глобальные переменные для таймера
 alarm_id_t audio_timer_id = 0;
 
-// PIO и SM для импульсов
-PIO ppm_pio = nullptr;
-uint ppm_sm = 0;
-
 // Указатель на PPMController для использования в прерываниях
 PPMController *ppm_controller = nullptr;
 
-// Функция отправки значения в PIO (передаем текущий код задержки)
-void send_ppm_value(uint32_t value) {
-  if (ppm_pio != nullptr) {
-    pio_sm_put_blocking(ppm_pio, ppm_sm, value);
+// Статистика: время от сброса до первого импульса и худшее время команды
+struct PPMStats {
+  volatile uint32_t first_pulse_us = 0;
+  uint32_t cmd_max_us = 0;
+  uint32_t reclock_blackout_us = 0;
+};
+
+PPMStats ppm_stats;
+
+using ResponseBuffer = ppm::TextBuffer<512>;
+
+void note_first_pulse() {
+  if (ppm_stats.first_pulse_us == 0) {
+    ppm_stats.first_pulse_us = timer_hw->timerawl;
   }
 }
 
@@ -160,17 +364,273 @@ void timer0_irq_handler() {
   if (timer_hw->intr & (1u << 0)) {
     timer_hw->intr = 1u << 0;
 
-    uint32_t delay_value = PPMController::MIN_INTERVAL_CYCLES;
     if (ppm_controller) {
-      delay_value += ppm_controller->getCurrentCode();
+      ppm_controller->onFrameAlarm();
+    }
+    note_first_pulse();
+  }
+}
+
+void timer1_irq_handler() {
+  if (timer_hw->intr & (1u << 1)) {
+    timer_hw->intr = 1u << 1;
+
+    if (ppm_controller) {
+      ppm_controller->onSecondPulse();
     }
-    send_ppm_value(delay_value);
-    timer_hw->alarm[0] = timer_hw->timerawl + PPMController::AUDIO_FRAME_TICKS;
+  }
+}
+
+void pio0_irq_handler() {
+  if (ppm_controller) {
+    ppm_controller->onFifoNotFull();
+  }
+  note_first_pulse();
+}
+
+// Перестройка PLL_SYS с подходящим напряжением ядра
+bool apply_sys_clock(uint32_t mhz) {
+  uint32_t khz = mhz * 1000;
+  uint vco_freq, post_div1, post_div2;
+  if (!ppm::is_clock_profile(mhz) ||
+      !check_sys_clock_khz(khz, &vco_freq, &post_div1, &post_div2)) {
+    return false;
+  }
+
+  // Разгон выше 133 МГц требует повышенного напряжения ядра
+  if (khz > 133000) {
+    vreg_set_voltage(VREG_VOLTAGE_1_20);
+    busy_wait_us(100);
+  }
+  set_sys_clock_pll(vco_freq, post_div1, post_div2);
+  if (khz <= 133000) {
+    vreg_set_voltage(VREG_VOLTAGE_DEFAULT);
+  }
+  return true;
+}
+
+// Смена системной частоты без перепрошивки. Вывод останавливается на
+// границе фрейма, после перестройки PLL таблицы задержек пересчитываются,
+// и фреймы возобновляются. USB тактируется от PLL_USB, её не трогаем.
+bool reclock_system(PPMController &ppmCtrl, uint32_t mhz) {
+  if (!ppm::is_clock_profile(mhz) ||
+      !ppm::modulation_fits(mhz * 1000, ppmCtrl.getCore().getModulation())) {
+    return false;
+  }
+
+  uint32_t start_us = time_us_32();
+  ppmCtrl.stop(RECLOCK_DRAIN_TIMEOUT_US);
+  bool ok = apply_sys_clock(mhz);
+  ppmCtrl.resume();
+
+  ppm_stats.reclock_blackout_us = time_us_32() - start_us;
+  return ok;
+}
+
+// Доступ ConfigStore к флешу. На время стирания и записи прерывания
+// запрещены и XIP недоступен, поэтому вывод останавливается заранее.
+struct PicoFlash {
+  const uint8_t *read(uint32_t offset) {
+    return reinterpret_cast<const uint8_t *>(XIP_BASE + CONFIG_FLASH_OFFSET +
+                                             offset);
+  }
+
+  void erase(uint32_t offset) {
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(CONFIG_FLASH_OFFSET + offset, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+  }
+
+  void program(uint32_t offset, const uint8_t *data) {
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(CONFIG_FLASH_OFFSET + offset, data, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+  }
+};
+
+PicoFlash pico_flash;
+ppm::ConfigStore<PicoFlash> config_store(pico_flash);
+
+void save_config(PPMController &ppmCtrl) {
+  ppm::DeviceConfig config = ppm::default_config();
+  ppmCtrl.captureConfig(config);
+  ppmCtrl.stop(RECLOCK_DRAIN_TIMEOUT_US);
+  config_store.save(config);
+  ppmCtrl.resume();
+}
+
+// Длинные ответы (таблица BENCH) не помещаются в буфер CDC сразу
+void cdc_write(const ResponseBuffer &response) {
+  const char *data = response.data();
+  uint32_t left = response.size();
+  uint32_t start_us = time_us_32();
+  while (left > 0 && tud_cdc_connected() &&
+         time_us_32() - start_us < CDC_WRITE_TIMEOUT_US) {
+    uint32_t written = tud_cdc_write(data, left);
+    data += written;
+    left -= written;
+    tud_cdc_write_flush();
+    if (left > 0) {
+      tud_task();
+    }
+  }
+}
+
+// Таблица замера BENCH: строка на ступень, затем лучшие периоды
+void run_bench(PPMController &ppmCtrl, ResponseBuffer &response) {
+  ResponseBuffer row;
+  row.str("\r\nfeed  gap_us range period rate_khz frames misses lat_us "
+          "isr_cyc headroom\r\n");
+  cdc_write(row);
+
+  const uint32_t sys_khz = ppmCtrl.getCore().getTiming().sys_khz;
+  uint32_t best[ppm::BENCH_FEED_COUNT] = {};
+  ppmCtrl.bench(
+      [&](const ppm::BenchStep &step, const ppm::BenchResult &result) {
+        row.clear();
+        row.str(ppm::BENCH_FEED_NAMES[static_cast<size_t>(step.feed)])
+            .str(" ")
+            .num(static_cast<uint32_t>(step.min_interval / (sys_khz / 1000)))
+            .str(" ")
+            .num(static_cast<uint32_t>(step.code_range))
+            .str(" ")
+            .num(step.period)
+            .str(" ")
+            .fixed(static_cast<float>(sys_khz) / step.period, 1)
+            .str(" ")
+            .num(result.frames)
+            .str(" ")
+            .num(result.misses)
+            .str(" ");
+        if (step.feed == ppm::BenchFeed::TimerIsr) {
+          row.num(result.latency_max_us);
+        } else {
+          row.str("-");
+        }
+        row.str(" ").num(result.isr_cycles_max).str(" ");
+        if (result.headroom_min == INT32_MAX) {
+          row.str("-");
+        } else {
+          row.num(result.headroom_min);
+        }
+        row.str("\r\n");
+        cdc_write(row);
+      },
+      // USB обслуживается и во время ступени: весь замер идёт секунды
+      [] { tud_task(); }, best);
+
+  response.str("Лучший период, такты (");
+  response.num(ppm::make_timing_profile(sys_khz).frame_cycles).str(" ном.):");
+  for (size_t f = 0; f < ppm::BENCH_FEED_COUNT; f++) {
+    response.str(" ").str(ppm::BENCH_FEED_NAMES[f]).str("=").num(best[f]);
+  }
+  response.str("\r\n");
+}
+
+// Команды над железом для ppm::handle_command: частота, программа
+// энкодера, флеш и BENCH
+struct PicoDevice {
+  PPMController &ctrl;
+
+  EncoderCore &core() { return ctrl.getCore(); }
+  bool setModulation(ppm::Modulation m) { return ctrl.setModulation(m); }
+  const char *encoderName() const { return ctrl.getEncoder().name; }
+
+  void handleDevice(const ppm::Command &cmd, ResponseBuffer &response) {
+    switch (cmd.id) {
+    case ppm::CommandId::Reclock:
+      if (cmd.ivalue > 0 && reclock_system(ctrl, cmd.ivalue)) {
+        response.str("\r\nЧастота: ")
+            .num(core().getTiming().sys_khz / 1000)
+            .str(" МГц, пауза вывода: ")
+            .num(ppm_stats.reclock_blackout_us)
+            .str(" мкс\r\n");
+      } else {
+        response.str("\r\nНедопустимая частота: ").num(cmd.ivalue).str("\r\n");
+      }
+      break;
+
+    case ppm::CommandId::Encoder: {
+      int index = ppm::EncoderRegistry::find(cmd.word.data(), cmd.word.size());
+      if (index >= 0 && ctrl.selectEncoder(index)) {
+        response.str("\r\nЭнкодер: ").str(encoderName());
+        if (ctrl.getEncoder().feed == ppm::EncoderFeed::CpuPulse)
+          response.str(", шаг паузы 1 мкс = ")
+              .num(ctrl.getCore().getTiming().sys_khz / 1000)
+              .str(" кодов");
+        response.str("\r\n");
+      } else {
+        response.str("\r\nНеизвестный энкодер: ").str(cmd.word).str("\r\n");
+      }
+      break;
+    }
+
+    case ppm::CommandId::Save:
+      save_config(ctrl);
+      response.str("\r\nКонфигурация сохранена, запись ")
+          .num(config_store.getSeq())
+          .str("\r\n");
+      break;
+
+    case ppm::CommandId::Bench:
+      run_bench(ctrl, response);
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  void appendStats(ResponseBuffer &response) {
+    response.str(" cfg_seq=")
+        .num(config_store.getSeq())
+        .str(" first_pulse_us=")
+        .num(ppm_stats.first_pulse_us)
+        .str(" cmd_max_us=")
+        .num(ppm_stats.cmd_max_us)
+        .str(" reclock_us=")
+        .num(ppm_stats.reclock_blackout_us);
+  }
+};
+
+void process_line(PPMController &ppmCtrl,
+                  const ppm::LineBuffer<ppm::COMMAND_LINE_SIZE> &line) {
+  uint32_t start_us = time_us_32();
+  ResponseBuffer response;
+  PicoDevice device{ppmCtrl};
+  ppm::handle_line(device, line, response);
+  cdc_write(response);
+
+  uint32_t elapsed_us = time_us_32() - start_us;
+  if (elapsed_us > ppm_stats.cmd_max_us) {
+    ppm_stats.cmd_max_us = elapsed_us;
   }
 }
 
 int main() {
-  set_sys_clock_khz(SYS_FREQ, true);
+  // Сначала вывод по сохранённой конфигурации, USB - потом: приёмники
+  // захватывают сигнал, не дожидаясь энумерации
+  ppm::DeviceConfig config = ppm::default_config();
+  if (!config_store.load(config)) {
+    config.sys_mhz = SYS_FREQ / 1000;
+  }
+  if (!apply_sys_clock(config.sys_mhz)) {
+    set_sys_clock_khz(SYS_FREQ, true);
+  }
+
+  // Очередь отсчётов не помещается в стек ядра
+  static PPMController ppmCtrl;
+  ppmCtrl.init(config);
+  ppm_controller = &ppmCtrl; // Сохраняем для использования в прерываниях
+
+  irq_set_exclusive_handler(TIMER_IRQ_0, timer0_irq_handler);
+  irq_set_exclusive_handler(TIMER_IRQ_1, timer1_irq_handler);
+  irq_set_exclusive_handler(PIO0_IRQ_0, pio0_irq_handler);
+  irq_set_enabled(PIO0_IRQ_0, true);
+
+  hw_set_bits(&timer_hw->inte, (1u << 0) | (1u << 1));
+  ppmCtrl.startFeed(timer_hw->timerawl + 2);
+
   board_init();
   tusb_init();
 
@@ -185,28 +645,11 @@ int main() {
   }
   stdio_init_all();
 
-  PPMController ppmCtrl;
-  ppmCtrl.init();
-  ppm_controller = &ppmCtrl; // Сохраняем для использования в прерываниях
-
-  // Сохраняем PIO и SM для использования в прерываниях
-  ppm_pio = pio0;
-  ppm_sm = 0;
-
-  ppmCtrl.sendCode(0);
-
-  irq_set_exclusive_handler(TIMER_IRQ_0, timer0_irq_handler);
-
-  hw_set_bits(&timer_hw->inte, (1u << 0));
-  irq_set_enabled(TIMER_IRQ_0, true);
-
-  timer_hw->alarm[0] = timer_hw->timerawl + PPMController::AUDIO_FRAME_TICKS;
-
-  std::string command_buffer;
+  ppm::StreamParser<PPMController> parser(ppmCtrl);
 
   while (true) {
     tud_task();
-    ppmCtrl.test_mode_update();
+    ppmCtrl.getCore().testUpdate();
 
     if (absolute_time_diff_us(get_absolute_time(), next_led_toggle_time) <= 0) {
       led_state = !led_state;
@@ -215,80 +658,47 @@ int main() {
     }
 
     if (tud_cdc_connected()) {
-      if (tud_cdc_available()) {
-        uint8_t buf[64];
-        uint32_t count = tud_cdc_read(buf, sizeof(buf));
-
-        if (count > 0) {
-          // Эхо данных
-          tud_cdc_write(buf, count);
-          tud_cdc_write_flush();
-
-          // Обработка входных символов
-          for (uint32_t i = 0; i < count; i++) {
-            char c = static_cast<char>(buf[i]);
-
-            // Проверяем, нажат ли Enter
-            if (c == '\r' || c == '\n') {
-              // Обрабатываем команду, если буфер не пустой
-              if (!command_buffer.empty()) {
-                uint16_t code;
-                if (ppmCtrl.parseCommand(command_buffer, code)) {
-                  // Проверяем тип команды
-                  if (command_buffer[0] == 'T' || command_buffer[0] == 't') {
-                    // Команда режима тестирования
-                    std::string mode =
-                        ppmCtrl.isTestMode() ? "включен" : "выключен";
-                    std::string response =
-                        "\r\nРежим тестирования " + mode + "\r\n";
-                    tud_cdc_write(response.c_str(), response.length());
-                    tud_cdc_write_flush();
-                  } else if (command_buffer[0] == 'P' ||
-                             command_buffer[0] == 'p') {
-                    // Команда установки периода обновления
-                    std::string response =
-                        "\r\nПериод обновления установлен: " +
-                        std::to_string(ppmCtrl.getTestUpdatePeriod()) +
-                        " сек\r\n";
-                    tud_cdc_write(response.c_str(), response.length());
-                    tud_cdc_write_flush();
-                  } else {
-                    // Обычная команда кода
-                    ppmCtrl.sendCode(code);
-                    std::string response =
-                        "\r\nPPM code sent: " + std::to_string(code) + "\r\n";
-                    tud_cdc_write(response.c_str(), response.length());
-                    tud_cdc_write_flush();
-                  }
-                } else {
-                  // Если команда не распознана
-                  std::string error =
-                      "\r\nНераспознанная команда: " + command_buffer + "\r\n";
-                  tud_cdc_write(error.c_str(), error.length());
-                  tud_cdc_write_flush();
-                }
-
-                // Очищаем буфер после обработки команды
-                command_buffer.clear();
-              }
-            } else if (c == 127 || c == 8) {
-              // Обработка Backspace или Delete
-              if (!command_buffer.empty()) {
-                command_buffer.pop_back();
-              }
-            } else {
-              // Добавляем символ в буфер
-              command_buffer.push_back(c);
-            }
+      // Читаем, только если очередь вместит прочитанное вместе с порцией,
+      // накопленной в разборщике: иначе хост ждёт освобождения места
+      const ppm::BufferProfile &profile = ppmCtrl.getCore().getBufferProfile();
+      parser.setBlockSize(profile.block_size);
+      if (tud_cdc_available() &&
+          ppmCtrl.getCore().getSamples().space() >= profile.read_size) {
+        uint8_t buf[CDC_READ_MAX];
+        uint8_t echo[CDC_READ_MAX];
+        uint32_t echo_len = 0;
+        uint32_t count = tud_cdc_read(buf, profile.read_size);
+
+        // Обработка входных символов, эхо только для текста
+        for (uint32_t i = 0; i < count; i++) {
+          ppm::InputResult r = parser.feed(buf[i]);
+          if (r.echo) {
+            echo[echo_len++] = buf[i];
           }
+          if (r.line) {
+            tud_cdc_write(echo, echo_len);
+            echo_len = 0;
+            process_line(ppmCtrl, parser.line());
+            // Очищаем буфер после обработки команды
+            parser.clearLine();
+          }
+        }
+        if (echo_len > 0) {
+          tud_cdc_write(echo, echo_len);
+          tud_cdc_write_flush();
         }
       }
     } else {
       // Небольшая пауза при отсутствии подключения
       sleep_ms(10);
-      command_buffer.clear(); // Очистить буфер, если соединение пропало
+      parser.reset(); // Очистить буфер, если соединение пропало
+    }
+
+    // В простое ядро спит до прерывания: USB, таймер фреймов поддержки
+    if (ppmCtrl.isIdle()) {
+      __wfi();
     }
   }
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,169 @@
+// Приёмник PPM с разнесёнными входами: два фотоприёмника на RX_PINS.
+//
+// Ядро 1 непрерывно разбирает кольца DMA (ppm_receiver.h), ядро 0 раз в
+// секунду выводит в USB-консоль счётчики входов и сведения: вывод в USB
+// может задержаться дольше, чем длится кольцо входа.
+#include <cstdint>
+#include <cstdio>
+
+#include "hardware/clocks.h"
+#include "hardware/pio.h"
+#include "hardware/vreg.h"
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+
+#include "ppm.pio.h"
+#include "ppm_audio.h"
+#include "ppm_decoder.h"
+#include "ppm_dsp.h"
+#include "ppm_receiver.h"
+#include "ppm_timing.h"
+
+// Частота энкодера: метки фронтов - в его тактах (отсчёт входа раз в
+// ppm::RX_SAMPLE_DIV тактов)
+#define SYS_FREQ 133000
+// Фреймов на отсчёт звука: 1 - моно, 2 - стерео TDM
+#define RX_SLOTS 1
+// 1 - снимать предыскажение передатчика (DSP_RX_PRESET): энкодеру
+// загружен набор DSP_TX_PRESET из dsp_design.py
+#define RX_RESTORE 0
+// Отсчётов на блок восстановления
+#define RX_PCM_BLOCK 32
+#define STATS_INTERVAL_US 1000000
+
+static const uint RX_PINS[ppm::RX_INPUTS] = {2, 3};
+
+static const ppm::TimingProfile rx_timing =
+    ppm::make_timing_profile(SYS_FREQ, RX_SLOTS);
+static_assert(ppm::modulation_fits(SYS_FREQ, RX_SLOTS == 2
+                                                 ? ppm::Modulation::Tdm
+                                                 : ppm::Modulation::Mono),
+              "encoder does not support this modulation at SYS_FREQ");
+static_assert(RX_PCM_BLOCK % RX_SLOTS == 0, "TDM pair split across blocks");
+// Кольца DMA выровнены по своему размеру, поэтому приёмник статический
+static ppm::DiversityReceiver receiver(pio0, RX_PINS, rx_timing);
+
+// Счётчики ядра 1; ядро 0 только читает
+static volatile uint32_t rx_samples = 0;
+static volatile uint32_t rx_busy_us = 0;
+static volatile int16_t rx_last[2] = {0, 0};
+
+// Блок отсчётов после восстановления; последний кадр - в rx_last
+static void flush_pcm(ppm::DspChain &restore, int16_t *pcm, size_t &count) {
+  if (count == 0)
+    return;
+  if (RX_RESTORE)
+    restore.process(pcm, count);
+  if (RX_SLOTS == 2) {
+    rx_last[0] = pcm[count - 2];
+    rx_last[1] = pcm[count - 1];
+  } else {
+    rx_last[0] = pcm[count - 1];
+  }
+  count = 0;
+}
+
+static void core1_main() {
+  ppm::TdmDeinterleaver deinterleaver;
+  ppm::DspChain restore;
+  restore.setChannels(RX_SLOTS);
+  if (RX_RESTORE)
+    ppm::load_dsp_preset(restore, ppm::DSP_RX_PRESET[RX_SLOTS - 1], 0);
+  int16_t pcm[RX_PCM_BLOCK];
+  size_t pcm_count = 0;
+  int16_t held = 0;
+  while (true) {
+    uint32_t start = time_us_32();
+    bool worked = receiver.poll([&](const ppm::Frame *frames, size_t count) {
+      for (size_t k = 0; k < count; k++) {
+        uint16_t code = frames[k].code;
+        if (RX_SLOTS == 2) {
+          int16_t left, right;
+          if (!deinterleaver.push(code, left, right))
+            continue;
+          pcm[pcm_count++] = left;
+          pcm[pcm_count++] = right;
+        } else {
+          // На месте преамбулы остаётся предыдущий отсчёт
+          if (code != ppm::SYNC_CODE) {
+            if (code >= ppm::MAX_CODE)
+              code = ppm::MAX_CODE - 1;
+            held = ppm::code_to_pcm(code, ppm::MAX_CODE);
+          }
+          pcm[pcm_count++] = held;
+        }
+        rx_samples = rx_samples + 1;
+        if (pcm_count == RX_PCM_BLOCK)
+          flush_pcm(restore, pcm, pcm_count);
+      }
+      flush_pcm(restore, pcm, pcm_count);
+    });
+    if (worked)
+      rx_busy_us = rx_busy_us + (time_us_32() - start);
+  }
+}
+
+static void print_stats(uint32_t samples, uint32_t busy_us, uint32_t span_us) {
+  const ppm::DiversityStats &d = receiver.getStats();
+  for (size_t i = 0; i < ppm::RX_INPUTS; i++) {
+    ppm::ReceiverInputStats in = receiver.getInputStats(i);
+    printf("in%u pin=%u frames=%lu lost=%lu spurious=%lu keepalive=%lu "
+           "sync=%lu locks=%lu sync_locks=%lu lock_us=%lu lock_max_us=%lu "
+           "missed=%lu rejected=%lu overruns=%lu\n",
+           static_cast<unsigned>(i), RX_PINS[i],
+           static_cast<unsigned long>(in.decoder.frames),
+           static_cast<unsigned long>(in.decoder.lost),
+           static_cast<unsigned long>(in.decoder.spurious),
+           static_cast<unsigned long>(in.decoder.keepalive),
+           static_cast<unsigned long>(in.decoder.sync),
+           static_cast<unsigned long>(in.decoder.lock_count),
+           static_cast<unsigned long>(in.decoder.sync_locks),
+           static_cast<unsigned long>(in.decoder.lock_cycles /
+                                      (SYS_FREQ / 1000)),
+           static_cast<unsigned long>(in.decoder.lock_cycles_max /
+                                      (SYS_FREQ / 1000)),
+           static_cast<unsigned long>(d.missed[i]),
+           static_cast<unsigned long>(d.rejected[i]),
+           static_cast<unsigned long>(in.overruns));
+  }
+  printf("combined frames=%lu merged=%lu disagree=%lu lost=%lu "
+         "samples/s=%lu last=%d,%d core1_busy=%lu%%\n",
+         static_cast<unsigned long>(d.frames),
+         static_cast<unsigned long>(d.merged),
+         static_cast<unsigned long>(d.disagree),
+         static_cast<unsigned long>(d.lost),
+         static_cast<unsigned long>(
+             static_cast<uint64_t>(samples) * 1000000 / span_us),
+         rx_last[0], rx_last[1],
+         static_cast<unsigned long>(static_cast<uint64_t>(busy_us) * 100 / span_us));
+}
+
+int main() {
+  if (SYS_FREQ > 133000) {
+    vreg_set_voltage(VREG_VOLTAGE_1_20);
+    busy_wait_us(100);
+  }
+  set_sys_clock_khz(SYS_FREQ, true);
+  stdio_init_all();
+
+  receiver.start(rx_timing.pio_freq);
+  multicore_launch_core1(core1_main);
+
+  uint32_t last_samples = 0;
+  uint32_t last_busy = 0;
+  uint32_t last_us = time_us_32();
+  while (true) {
+    sleep_ms(10);
+    uint32_t now = time_us_32();
+    if (now - last_us < STATS_INTERVAL_US)
+      continue;
+    uint32_t samples = rx_samples;
+    uint32_t busy = rx_busy_us;
+    print_stats(samples - last_samples, busy - last_busy, now - last_us);
+    last_samples = samples;
+    last_busy = busy;
+    last_us = now;
+  }
+
+  return 0;
+}
@@ -0,0 +1,369 @@
+// Аудиотракт энкодера: очередь отсчётов и отображение PCM в коды PPM.
+//
+// Стереорежим TDM передаёт левый и правый каналы в чередующихся фреймах
+// с удвоенной частотой. Кодовое пространство делится пополам: правый слот
+// занимает коды [0, MAX_CODE/2), левый - [MAX_CODE/2, MAX_CODE), так что
+// метка левого слота читается из каждого фрейма без дополнительных
+// импульсов. Заголовок не зависит от Pico SDK.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "ppm_timing.h"
+
+namespace ppm {
+
+enum class Modulation : uint8_t {
+  Mono, // один канал, фрейм на отсчёт
+  Tdm,  // стерео, L и R в чередующихся фреймах
+};
+
+constexpr uint8_t modulation_slots(Modulation m) {
+  return m == Modulation::Tdm ? 2 : 1;
+}
+
+// Модуляция допустима при частоте sys_khz (см. frame_fits)
+constexpr bool modulation_fits(uint32_t sys_khz, Modulation m) {
+  return frame_fits(make_timing_profile(sys_khz, modulation_slots(m)));
+}
+
+enum class TdmSlot : uint8_t { Left, Right };
+
+constexpr uint16_t TDM_SLOT_RANGE = MAX_CODE / 2;
+
+// Отсчёт int16 -> код [0, range)
+constexpr uint16_t pcm_to_code(int16_t sample, uint16_t range) {
+  return static_cast<uint16_t>(
+      (static_cast<uint32_t>(sample + 32768) * range) >> 16);
+}
+
+// Код [0, range) -> отсчёт int16 (середина интервала кода)
+constexpr int16_t code_to_pcm(uint16_t code, uint16_t range) {
+  return static_cast<int16_t>(
+      static_cast<int32_t>(((2u * code + 1u) << 15) / range) - 32768);
+}
+
+// Код слота TDM из кода полного диапазона [0, MAX_CODE)
+constexpr uint16_t tdm_slot_code(uint16_t code, TdmSlot slot) {
+  uint16_t scaled = static_cast<uint16_t>(code / 2);
+  if (scaled >= TDM_SLOT_RANGE)
+    scaled = TDM_SLOT_RANGE - 1;
+  return slot == TdmSlot::Left ? TDM_SLOT_RANGE + scaled : scaled;
+}
+
+constexpr TdmSlot tdm_code_slot(uint16_t code) {
+  return code >= TDM_SLOT_RANGE ? TdmSlot::Left : TdmSlot::Right;
+}
+
+// Кольцевая очередь отсчётов: один писатель (основной цикл),
+// один читатель (прерывание фрейма). N - степень двойки.
+template <size_t N> class SampleQueue {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  size_t size() const {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+  }
+  size_t space() const {
+    size_t used = size();
+    return used < limit ? limit - used : 0;
+  }
+  static constexpr size_t capacity() { return N; }
+
+  // Рабочая глубина очереди: меньше N - меньше задержка до вывода
+  void setLimit(size_t n) { limit = n == 0 || n > N ? N : n; }
+  size_t getLimit() const { return limit; }
+
+  // Сквозные номера следующего записываемого и читаемого отсчёта
+  uint32_t writeIndex() const { return head.load(std::memory_order_relaxed); }
+  uint32_t readIndex() const { return tail.load(std::memory_order_relaxed); }
+
+  // Записать не больше свободного места; возвращает число записанных
+  size_t write(const int16_t *src, size_t count) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    size_t n = count < space() ? count : space();
+    for (size_t i = 0; i < n; i++) {
+      buf[(h + i) & (N - 1)] = src[i];
+    }
+    head.store(h + n, std::memory_order_release);
+    return n;
+  }
+
+  // Отсчёт offset от начала очереди без извлечения
+  bool peek(size_t offset, int16_t &sample) const {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) - t <= offset)
+      return false;
+    sample = buf[(t + offset) & (N - 1)];
+    return true;
+  }
+
+  bool pop(int16_t &sample) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) == t)
+      return false;
+    sample = buf[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Забрать пару L/R целиком, чтобы каналы не перепутались при опустошении
+  bool popPair(int16_t &left, int16_t &right) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) - t < 2)
+      return false;
+    left = buf[t & (N - 1)];
+    right = buf[(t + 1) & (N - 1)];
+    tail.store(t + 2, std::memory_order_release);
+    return true;
+  }
+
+  void clear() { tail.store(head.load(std::memory_order_acquire)); }
+
+private:
+  int16_t buf[N];
+  size_t limit = N;
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+};
+
+// Источник кодов для фреймов: берёт отсчёты прямо из чередующегося
+// буфера L,R,L,R и выдаёт коды в порядке слотов без копирования
+// в раздельные каналы. При опустошении очереди выдаёт код по умолчанию.
+template <size_t N> class FrameSource {
+public:
+  explicit FrameSource(SampleQueue<N> &queue_) : queue(queue_) {}
+
+  void setModulation(Modulation m) {
+    modulation = m;
+    slot = TdmSlot::Left;
+  }
+  Modulation getModulation() const { return modulation; }
+
+  // Какой входной канал (0 - первый в паре, 1 - второй) идёт в слот L и R
+  void setChannelMap(uint8_t left, uint8_t right) {
+    channelMap[0] = left & 1;
+    channelMap[1] = right & 1;
+  }
+  const uint8_t *getChannelMap() const { return channelMap; }
+
+  // Пометить отсчёт с номером index (SampleQueue::writeIndex): takeMarker()
+  // вернёт true один раз, когда этот отсчёт уйдёт во фрейм
+  void armMarker(uint32_t index) {
+    markerIndex = index;
+    markerArmed.store(true, std::memory_order_release);
+  }
+
+  bool takeMarker() {
+    if (!markerHit)
+      return false;
+    markerHit = false;
+    return true;
+  }
+
+  // Код следующего фрейма; fallback - код полного диапазона
+  uint16_t next(uint16_t fallback) {
+    int16_t sample;
+    uint32_t first = queue.readIndex();
+    if (modulation == Modulation::Mono) {
+      if (queue.pop(sample)) {
+        streaming = true;
+        checkMarker(first, 1);
+        return pcm_to_code(sample, MAX_CODE);
+      }
+      starve();
+      return fallback;
+    }
+
+    TdmSlot current = slot;
+    slot = current == TdmSlot::Left ? TdmSlot::Right : TdmSlot::Left;
+    if (current == TdmSlot::Left) {
+      int16_t pair[2];
+      if (queue.popPair(pair[0], pair[1])) {
+        streaming = true;
+        checkMarker(first, 2);
+        pendingRight = pair[channelMap[1]];
+        havePendingRight = true;
+        return TDM_SLOT_RANGE +
+               pcm_to_code(pair[channelMap[0]], TDM_SLOT_RANGE);
+      }
+      havePendingRight = false;
+      starve();
+      return tdm_slot_code(fallback, TdmSlot::Left);
+    }
+    if (havePendingRight) {
+      havePendingRight = false;
+      return pcm_to_code(pendingRight, TDM_SLOT_RANGE);
+    }
+    return tdm_slot_code(fallback, TdmSlot::Right);
+  }
+
+  // Код фрейма поддержки связи в простое: отсчёты не расходуются, слоты
+  // TDM чередуются как обычно
+  uint16_t keepalive(uint16_t code) {
+    if (modulation == Modulation::Mono)
+      return code;
+    TdmSlot current = slot;
+    slot = current == TdmSlot::Left ? TdmSlot::Right : TdmSlot::Left;
+    havePendingRight = false;
+    return tdm_slot_code(code, current);
+  }
+
+  // Следующий фрейм начинает пару L,R (в моно - всегда)
+  bool atPairBoundary() const {
+    return modulation == Modulation::Mono || slot == TdmSlot::Left;
+  }
+
+  // Выбросить тихие отсчёты (в TDM - пары) из начала очереди; true, если
+  // в начале остался громкий
+  template <typename Silent> bool drainSilence(Silent &&silent) {
+    const size_t step = modulation == Modulation::Mono ? 1 : 2;
+    int16_t sample;
+    for (;;) {
+      for (size_t i = 0; i < step; i++) {
+        if (!queue.peek(i, sample))
+          return false;
+        if (!silent(sample))
+          return true;
+      }
+      for (size_t i = 0; i < step; i++)
+        queue.pop(sample);
+    }
+  }
+
+  // Число случаев, когда поток отсчётов прервался из-за пустой очереди
+  uint32_t getUnderruns() const { return underruns; }
+
+private:
+  void checkMarker(uint32_t first, uint32_t count) {
+    if (!markerArmed.load(std::memory_order_acquire))
+      return;
+    int32_t offset = static_cast<int32_t>(markerIndex - first);
+    if (offset < static_cast<int32_t>(count)) {
+      // offset < 0: отсчёт пропал при очистке очереди
+      markerArmed.store(false, std::memory_order_relaxed);
+      markerHit = offset >= 0;
+    }
+  }
+
+  void starve() {
+    if (streaming) {
+      streaming = false;
+      underruns++;
+    }
+  }
+
+  SampleQueue<N> &queue;
+  Modulation modulation = Modulation::Mono;
+  TdmSlot slot = TdmSlot::Left;
+  uint8_t channelMap[2] = {0, 1};
+  int16_t pendingRight = 0;
+  bool havePendingRight = false;
+  bool streaming = false;
+  uint32_t underruns = 0;
+  uint32_t markerIndex = 0;
+  std::atomic<bool> markerArmed{false};
+  bool markerHit = false;
+};
+
+// Простой энкодера. После серии из frames фреймов с кодом в пределах
+// threshold кодов полного диапазона от середины шкалы (тихий поток, пустая
+// очередь при тихом коде по умолчанию) фреймы идут раз в
+// IDLE_KEEPALIVE_PERIODS периодов с кодом IDLE_CODE. Приёмник узнаёт их по
+// интервалу (FrameDecoder) и держит захват. Первый громкий отсчёт в
+// очереди возвращает полную частоту на ближайшем фрейме поддержки.
+constexpr uint32_t IDLE_KEEPALIVE_PERIODS = 4;
+constexpr uint16_t IDLE_CODE = MAX_CODE / 2;
+constexpr uint32_t IDLE_DEFAULT_FRAMES = 1000000 / SAMPLE_PERIOD_US; // 1 с моно
+constexpr uint16_t IDLE_DEFAULT_THRESHOLD = 2;
+
+// Фрейм простоя в ppm_framed - одно слово, остаток фрейма 16-битный
+constexpr bool keepalive_fits_framed() {
+  for (uint32_t mhz : CLOCK_PROFILES_MHZ) {
+    if (make_timing_profile(mhz * 1000).frame_cycles * IDLE_KEEPALIVE_PERIODS >
+        0xFFFF)
+      return false;
+  }
+  return true;
+}
+static_assert(keepalive_fits_framed(),
+              "keepalive frame does not fit one ppm_framed word");
+
+class IdleGate {
+public:
+  // frames = 0 - простой выключен
+  void configure(uint32_t frames_, uint16_t threshold_) {
+    frames = frames_;
+    threshold = threshold_;
+    run = 0;
+  }
+  uint32_t getFrames() const { return frames; }
+  uint16_t getThreshold() const { return threshold; }
+
+  bool isIdle() const { return idle; }
+
+  // Вернуть полную частоту без учёта пробуждения (перезапуск вывода)
+  void reset() {
+    idle = false;
+    run = 0;
+  }
+
+  // Код полного диапазона близок к середине шкалы
+  bool codeSilent(uint16_t code) const {
+    int32_t d = static_cast<int32_t>(code) - MAX_CODE / 2;
+    return d <= threshold && -d <= threshold;
+  }
+
+  // Код фрейма; в TDM код слота приводится к полному диапазону
+  bool frameSilent(uint16_t code, Modulation m) const {
+    if (m == Modulation::Tdm)
+      code = static_cast<uint16_t>(code % TDM_SLOT_RANGE * 2);
+    return codeSilent(code);
+  }
+
+  bool sampleSilent(int16_t sample) const {
+    return codeSilent(pcm_to_code(sample, MAX_CODE));
+  }
+
+  // Фрейм полной частоты; true - серия тишины набрана и вывод уходит в
+  // простой. can_enter - фрейм на границе пары TDM.
+  bool noteFrame(bool silent, bool can_enter) {
+    activeFrames++;
+    if (!silent || frames == 0) {
+      run = 0;
+      return false;
+    }
+    if (run < frames)
+      run++;
+    if (run < frames || !can_enter)
+      return false;
+    idle = true;
+    entries++;
+    run = 0;
+    return true;
+  }
+
+  void noteKeepalive() { idlePeriods += IDLE_KEEPALIVE_PERIODS; }
+  void wake() { idle = false; }
+
+  // Доля периодов фрейма в простое с начала работы, %
+  uint32_t idlePercent() const {
+    uint64_t total = activeFrames + idlePeriods;
+    return total ? static_cast<uint32_t>(idlePeriods * 100 / total) : 0;
+  }
+  uint32_t getEntries() const { return entries; }
+
+private:
+  uint32_t frames = 0;
+  uint16_t threshold = 0;
+  uint32_t run = 0;
+  volatile bool idle = false;
+  uint64_t activeFrames = 0;
+  uint64_t idlePeriods = 0;
+  uint32_t entries = 0;
+};
+
+} // namespace ppm
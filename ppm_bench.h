@@ -0,0 +1,361 @@
+// Самопроверка пределов подачи фреймов на конкретной плате (команда BENCH).
+//
+// Для каждого способа подачи - прерывание таймера (программа ppm), DMA и
+// прерывание FIFO самотактируемой программы (ppm_framed) - перебираются
+// минимальная пауза и диапазон кодов, а период фрейма уменьшается
+// ступенями, пока фреймы не начнут выходить не вовремя. На ступени по
+// аппаратному таймеру и SysTick меряются промахи, опоздание прерывания,
+// длительность обработчика и запас FIFO. Пока идёт замер, SM и
+// прерывания принадлежат стенду; обработчики прошивки затем
+// восстанавливаются. Замер идёт секунды, поэтому в ожидании каждой
+// ступени вызывается idle() - прошивка обслуживает в нём USB.
+#pragma once
+
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/structs/systick.h"
+#include "hardware/timer.h"
+
+#include "ppm.pio.h"
+#include "ppm_timing.h"
+
+namespace ppm {
+
+enum class BenchFeed : uint8_t {
+  TimerIsr, // слово паузы из прерывания таймера раз в фрейм
+  Dma,      // слова фреймов по кругу из двух буферов DMA
+  FifoIsr,  // пополнение FIFO из прерывания "TX не полон"
+};
+
+inline constexpr const char *BENCH_FEED_NAMES[] = {"timer", "dma", "fifo"};
+constexpr size_t BENCH_FEED_COUNT = 3;
+
+constexpr uint32_t BENCH_FRAMES = 2048; // фреймов на ступень
+constexpr uint8_t BENCH_MIN_GAP_US[] = {3, 2, 1};
+constexpr uint16_t BENCH_CODE_RANGES[] = {MAX_CODE, MAX_CODE / 4};
+// Периоды фрейма в шестнадцатых долях номинального
+constexpr uint8_t BENCH_PERIOD_SIXTEENTHS[] = {16, 12, 8, 6, 4, 3, 2, 1};
+// Половина кольца DMA; адрес чтения заворачивается аппаратно
+constexpr uint32_t BENCH_DMA_BLOCK = 16;
+constexpr uint BENCH_DMA_RING_BITS = 6;
+static_assert((1u << BENCH_DMA_RING_BITS) == BENCH_DMA_BLOCK * 4,
+              "DMA ring must cover one block");
+
+struct BenchStep {
+  BenchFeed feed;
+  uint16_t min_interval; // минимальная пауза, такты
+  uint16_t code_range;   // коды [0, code_range)
+  uint32_t period;       // период фрейма, такты
+};
+
+struct BenchResult {
+  uint32_t frames;
+  uint32_t misses;         // фреймов, вышедших не вовремя
+  uint32_t latency_max_us; // опоздание входа в прерывание таймера
+  uint32_t isr_cycles_max; // длительность обработчика, такты clk_sys
+  int32_t headroom_min;    // мкс до следующего фрейма (таймер) или слов
+                           // в очереди PIO и DMA
+};
+
+class FeedBench {
+public:
+  FeedBench(PIO pio_, uint sm_, uint pin_, uint ppm_offset_,
+            uint framed_offset_, uint32_t sys_khz_)
+      : pio(pio_), sm(sm_), pin(pin_), ppmOffset(ppm_offset_),
+        framedOffset(framed_offset_), sysKhz(sys_khz_) {}
+
+  // Прогнать все ступени; report(step, result) вызывается после каждой,
+  // idle() - в потоке, пока ступень идёт на прерываниях.
+  // Перебор периода останавливается на первой ступени с промахами.
+  template <typename Report, typename Idle>
+  void run(Report &&report, Idle &&idle) {
+    const TimingProfile nominal = make_timing_profile(sysKhz);
+    const uint32_t mhz = sysKhz / 1000;
+    dma[0] = dma_claim_unused_channel(true);
+    dma[1] = dma_claim_unused_channel(true);
+
+    for (size_t f = 0; f < BENCH_FEED_COUNT; f++) {
+      best[f] = 0;
+      for (uint8_t gap_us : BENCH_MIN_GAP_US) {
+        for (uint16_t range : BENCH_CODE_RANGES) {
+          for (uint8_t sixteenths : BENCH_PERIOD_SIXTEENTHS) {
+            BenchStep step{static_cast<BenchFeed>(f),
+                           static_cast<uint16_t>(gap_us * mhz), range,
+                           nominal.frame_cycles * sixteenths / 16};
+            // Таймер работает с шагом в микросекунду
+            if (step.feed == BenchFeed::TimerIsr)
+              step.period = (step.period + mhz - 1) / mhz * mhz;
+            if (step.period < maxGap(step) + 8)
+              break;
+
+            BenchResult result = runStep(step, idle);
+            report(step, result);
+            if (result.misses > 0)
+              break;
+            if (gap_us == MIN_PULSE_PERIOD_US && range == MAX_CODE)
+              best[f] = step.period;
+          }
+        }
+      }
+    }
+
+    dma_channel_unclaim(dma[0]);
+    dma_channel_unclaim(dma[1]);
+  }
+
+  // Кратчайший период без промахов при штатной паузе и полном диапазоне
+  uint32_t getBest(BenchFeed feed) const {
+    return best[static_cast<size_t>(feed)];
+  }
+
+private:
+  static uint32_t maxGap(const BenchStep &step) {
+    return step.min_interval + step.code_range - 1 + 3;
+  }
+
+  static void swapHandler(uint irq, irq_handler_t from, irq_handler_t to) {
+    if (from)
+      irq_remove_handler(irq, from);
+    if (to)
+      irq_set_exclusive_handler(irq, to);
+  }
+
+  // SysTick считает вниз, 24 бита
+  static uint32_t cyclesSince(uint32_t start) {
+    return (start - systick_hw->cvr) & 0x00FFFFFF;
+  }
+
+  uint16_t nextCode() {
+    lfsr ^= lfsr << 13;
+    lfsr ^= lfsr >> 17;
+    lfsr ^= lfsr << 5;
+    return static_cast<uint16_t>((lfsr >> 8) & (step.code_range - 1));
+  }
+
+  uint32_t nextGap() { return step.min_interval + nextCode() + 3; }
+
+  uint32_t nextFramedWord() {
+    return ppm_framed_word(nextGap(), step.period);
+  }
+
+  void noteHeadroom(int32_t headroom) {
+    if (headroom < result.headroom_min)
+      result.headroom_min = headroom;
+  }
+
+  void noteCycles(uint32_t start) {
+    uint32_t cycles = cyclesSince(start);
+    if (cycles > result.isr_cycles_max)
+      result.isr_cycles_max = cycles;
+  }
+
+  // TX FIFO опустел раньше, чем пришло слово: фрейм опоздал
+  void checkStall() {
+    uint32_t stall_mask = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm);
+    if (pio->fdebug & stall_mask) {
+      pio->fdebug = stall_mask;
+      result.misses++;
+    }
+  }
+
+  void clearStall() { pio->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm); }
+
+  void onTimer() {
+    uint32_t start = systick_hw->cvr;
+    timer_hw->intr = 1u << 0;
+    uint32_t now = timer_hw->timerawl;
+    uint32_t late = now - target;
+    if (late > result.latency_max_us)
+      result.latency_max_us = late;
+    noteHeadroom(static_cast<int32_t>(periodUs - late));
+
+    // SM ещё выводит предыдущий фрейм: период короче фрейма
+    if (!pio_sm_is_tx_fifo_empty(pio, sm) || pio_sm_get_pc(pio, sm) != ppmOffset)
+      result.misses++;
+    pio_sm_put(pio, sm, ppm_word(nextGap()));
+    if (++result.frames >= BENCH_FRAMES) {
+      done = true;
+      noteCycles(start);
+      return;
+    }
+
+    // Пропущенные моменты не наверстываются
+    target += periodUs;
+    while (static_cast<int32_t>(target - timer_hw->timerawl) < 2) {
+      target += periodUs;
+      result.misses++;
+    }
+    timer_hw->alarm[0] = target;
+    noteCycles(start);
+  }
+
+  void onFifo() {
+    uint32_t start = systick_hw->cvr;
+    checkStall();
+    noteHeadroom(static_cast<int32_t>(pio_sm_get_tx_fifo_level(pio, sm)));
+    while (!pio_sm_is_tx_fifo_full(pio, sm)) {
+      pio_sm_put(pio, sm, nextFramedWord());
+      result.frames++;
+    }
+    if (result.frames >= BENCH_FRAMES) {
+      pio_set_irq0_source_enabled(
+          pio, pio_get_tx_fifo_not_full_interrupt_source(sm), false);
+      done = true;
+    }
+    noteCycles(start);
+  }
+
+  void onDma() {
+    uint32_t start = systick_hw->cvr;
+    checkStall();
+    for (int i = 0; i < 2; i++) {
+      if (!dma_channel_get_irq0_status(dma[i]))
+        continue;
+      dma_channel_acknowledge_irq0(dma[i]);
+      noteHeadroom(static_cast<int32_t>(
+          dma_channel_hw_addr(dma[i ^ 1])->transfer_count +
+          pio_sm_get_tx_fifo_level(pio, sm)));
+      // Канал уже перезапущен цепочкой: старый блок выводится повторно
+      if (dma_channel_is_busy(dma[i]))
+        result.misses += BENCH_DMA_BLOCK;
+      fillBlock(i);
+      result.frames += BENCH_DMA_BLOCK;
+    }
+    if (result.frames >= BENCH_FRAMES)
+      done = true;
+    noteCycles(start);
+  }
+
+  void fillBlock(int i) {
+    for (uint32_t k = 0; k < BENCH_DMA_BLOCK; k++)
+      dmaBuf[i][k] = nextFramedWord();
+  }
+
+  static void timerHandler() { active->onTimer(); }
+  static void fifoHandler() { active->onFifo(); }
+  static void dmaHandler() { active->onDma(); }
+
+  void startTimer() {
+    ppm_program_init(pio, sm, ppmOffset, pin, sysKhz * 1000.0f);
+    target = timer_hw->timerawl + 10;
+    timer_hw->intr = 1u << 0;
+    timer_hw->alarm[0] = target;
+    irq_set_enabled(TIMER_IRQ_0, true);
+  }
+
+  void startFifo() {
+    ppm_framed_program_init(pio, sm, framedOffset, pin, sysKhz * 1000.0f);
+    while (!pio_sm_is_tx_fifo_full(pio, sm))
+      pio_sm_put(pio, sm, nextFramedWord());
+    clearStall();
+    pio_set_irq0_source_enabled(
+        pio, pio_get_tx_fifo_not_full_interrupt_source(sm), true);
+  }
+
+  void startDma() {
+    for (int i = 0; i < 2; i++) {
+      fillBlock(i);
+      dma_channel_config c = dma_channel_get_default_config(dma[i]);
+      channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+      channel_config_set_read_increment(&c, true);
+      channel_config_set_write_increment(&c, false);
+      channel_config_set_ring(&c, false, BENCH_DMA_RING_BITS);
+      channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+      channel_config_set_chain_to(&c, dma[i ^ 1]);
+      dma_channel_configure(dma[i], &c, &pio->txf[sm], dmaBuf[i],
+                            BENCH_DMA_BLOCK, false);
+      dma_channel_acknowledge_irq0(dma[i]);
+      dma_channel_set_irq0_enabled(dma[i], true);
+    }
+    irq_set_enabled(DMA_IRQ_0, true);
+    ppm_framed_program_init(pio, sm, framedOffset, pin, sysKhz * 1000.0f);
+    dma_channel_start(dma[0]);
+    while (pio_sm_is_tx_fifo_empty(pio, sm))
+      tight_loop_contents();
+    clearStall();
+  }
+
+  void stopAll() {
+    irq_set_enabled(TIMER_IRQ_0, false);
+    timer_hw->intr = 1u << 0;
+    pio_set_irq0_source_enabled(
+        pio, pio_get_tx_fifo_not_full_interrupt_source(sm), false);
+    irq_set_enabled(DMA_IRQ_0, false);
+    for (int i = 0; i < 2; i++) {
+      dma_channel_set_irq0_enabled(dma[i], false);
+      dma_channel_abort(dma[i]);
+      dma_channel_acknowledge_irq0(dma[i]);
+    }
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_clear_fifos(pio, sm);
+  }
+
+  template <typename Idle>
+  BenchResult runStep(const BenchStep &step_, Idle &idle) {
+    step = step_;
+    result = BenchResult{0, 0, 0, 0, INT32_MAX};
+    periodUs = step.period / (sysKhz / 1000);
+    lfsr = 0x1234567u;
+    done = false;
+    active = this;
+
+    irq_handler_t timer_saved = irq_get_exclusive_handler(TIMER_IRQ_0);
+    irq_handler_t pio_saved = irq_get_exclusive_handler(PIO0_IRQ_0);
+    bool pio_enabled = irq_is_enabled(PIO0_IRQ_0);
+    swapHandler(TIMER_IRQ_0, timer_saved, timerHandler);
+    swapHandler(PIO0_IRQ_0, pio_saved, fifoHandler);
+    irq_set_exclusive_handler(DMA_IRQ_0, dmaHandler);
+    irq_set_enabled(PIO0_IRQ_0, true);
+
+    // Запас по времени на ступень: вчетверо больше номинала
+    uint32_t timeout_us =
+        BENCH_FRAMES * (step.period / (sysKhz / 1000) + 1) * 4 + 10000;
+    uint32_t start_us = time_us_32();
+    switch (step.feed) {
+    case BenchFeed::TimerIsr:
+      startTimer();
+      break;
+    case BenchFeed::Dma:
+      startDma();
+      break;
+    case BenchFeed::FifoIsr:
+      startFifo();
+      break;
+    }
+    // Подача идёт на прерываниях, поток свободен
+    while (!done && time_us_32() - start_us < timeout_us)
+      idle();
+    stopAll();
+    if (!done)
+      result.misses++;
+
+    irq_remove_handler(DMA_IRQ_0, dmaHandler);
+    swapHandler(PIO0_IRQ_0, fifoHandler, pio_saved);
+    swapHandler(TIMER_IRQ_0, timerHandler, timer_saved);
+    irq_set_enabled(PIO0_IRQ_0, pio_enabled);
+    active = nullptr;
+    return result;
+  }
+
+  inline static FeedBench *active = nullptr;
+
+  PIO pio;
+  uint sm;
+  uint pin;
+  uint ppmOffset;
+  uint framedOffset;
+  uint32_t sysKhz;
+  uint dma[2] = {};
+  uint32_t best[BENCH_FEED_COUNT] = {};
+
+  BenchStep step{};
+  BenchResult result{};
+  uint32_t periodUs = 0;
+  uint32_t target = 0;
+  uint32_t lfsr = 0;
+  volatile bool done = false;
+  alignas(BENCH_DMA_BLOCK * 4) uint32_t dmaBuf[2][BENCH_DMA_BLOCK] = {};
+};
+
+} // namespace ppm
@@ -0,0 +1,261 @@
+// Командный интерфейс PPM без динамической памяти и исключений.
+//
+// Строка команды копится в буфере фиксированной ёмкости, разбирается по
+// таблице команд, известной на этапе компиляции, а ответ собирается в
+// фиксированном текстовом буфере. Заголовок не зависит от Pico SDK, чтобы
+// тот же разбор можно было собрать и на хосте.
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace ppm {
+
+// Буфер входной строки фиксированной ёмкости
+template <size_t N> class LineBuffer {
+public:
+  bool push(char c) {
+    if (len_ >= N) {
+      overflow_ = true;
+      return false;
+    }
+    data_[len_++] = c;
+    return true;
+  }
+
+  void pop() {
+    if (len_ > 0)
+      --len_;
+  }
+
+  void clear() {
+    len_ = 0;
+    overflow_ = false;
+  }
+
+  bool empty() const { return len_ == 0; }
+  bool overflowed() const { return overflow_; }
+  std::string_view view() const { return std::string_view(data_, len_); }
+
+private:
+  char data_[N];
+  size_t len_ = 0;
+  bool overflow_ = false;
+};
+
+// Текстовый буфер ответа фиксированной ёмкости (лишнее отбрасывается)
+template <size_t N> class TextBuffer {
+public:
+  TextBuffer &str(std::string_view s) {
+    for (char c : s) {
+      if (len_ >= N)
+        break;
+      data_[len_++] = c;
+    }
+    return *this;
+  }
+
+  TextBuffer &num(int32_t value) {
+    char tmp[12];
+    auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+    return str(std::string_view(tmp, res.ptr - tmp));
+  }
+
+  TextBuffer &num(uint32_t value) {
+    char tmp[11];
+    auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+    return str(std::string_view(tmp, res.ptr - tmp));
+  }
+
+  // Число с фиксированной точкой: без printf/dtoa, которые тянут malloc
+  TextBuffer &fixed(float value, uint8_t decimals = 3) {
+    if (value < 0) {
+      str("-");
+      value = -value;
+    }
+    uint32_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++)
+      scale *= 10;
+    uint32_t scaled = static_cast<uint32_t>(value * scale + 0.5f);
+    num(scaled / scale);
+    if (decimals > 0) {
+      str(".");
+      uint32_t frac = scaled % scale;
+      for (uint32_t div = scale / 10; div > 0; div /= 10) {
+        char digit = static_cast<char>('0' + frac / div % 10);
+        str(std::string_view(&digit, 1));
+      }
+    }
+    return *this;
+  }
+
+  void clear() { len_ = 0; }
+  const char *data() const { return data_; }
+  size_t size() const { return len_; }
+
+private:
+  char data_[N];
+  size_t len_ = 0;
+};
+
+enum class CommandId : uint8_t {
+  Test,       // T          - переключение тестового режима
+  Period,     // P:сек      - период обновления тестового кода
+  Code,       // C:код      - установка кода
+  Stats,      // S          - статистика
+  Reclock,    // R:МГц      - смена системной частоты
+  Encoder,    // E:имя      - смена PIO-программы энкодера
+  Modulation, // M:mono|tdm - моно или стерео TDM
+  Biquad,     // Q:n,b0..a2 - секция n эквалайзера, Q:n - обход
+  Limiter,    // L:порог    - порог ограничителя, 0 - выключен
+  Calibrate,  // K:узел,поправка - калибровка интервала в тактах
+  ChannelMap, // X:l,r      - входные каналы для слотов L и R
+  Save,       // W          - сохранить конфигурацию во флеш
+  Bench,      // BENCH      - замер пределов подачи фреймов
+  Buffering,  // B:профиль  - профиль буферизации latency/throughput
+  Idle,       // I:фреймы[,порог] - простой после тишины, I:0 - выключен
+  Sync,       // Y:фреймы   - период преамбулы синхронизации, 0 - выключена
+};
+
+enum class ArgKind : uint8_t { None, Int, Float, Word, IntList };
+
+constexpr size_t COMMAND_MAX_ARGS = 6;
+
+struct CommandSpec {
+  std::string_view name;
+  ArgKind arg;
+  CommandId id;
+};
+
+// Таблица команд. Имя сравнивается без учёта регистра, аргумент
+// отделяется двоеточием: "C:512", "P:0.5", "T".
+inline constexpr CommandSpec COMMANDS[] = {
+    {"T", ArgKind::None, CommandId::Test},
+    {"P", ArgKind::Float, CommandId::Period},
+    {"C", ArgKind::Int, CommandId::Code},
+    {"S", ArgKind::None, CommandId::Stats},
+    {"R", ArgKind::Int, CommandId::Reclock},
+    {"E", ArgKind::Word, CommandId::Encoder},
+    {"M", ArgKind::Word, CommandId::Modulation},
+    {"Q", ArgKind::IntList, CommandId::Biquad},
+    {"L", ArgKind::Int, CommandId::Limiter},
+    {"K", ArgKind::IntList, CommandId::Calibrate},
+    {"X", ArgKind::IntList, CommandId::ChannelMap},
+    {"W", ArgKind::None, CommandId::Save},
+    {"BENCH", ArgKind::None, CommandId::Bench},
+    {"B", ArgKind::Word, CommandId::Buffering},
+    {"I", ArgKind::IntList, CommandId::Idle},
+    {"Y", ArgKind::Int, CommandId::Sync},
+};
+
+// word ссылается на исходную строку и живёт, пока жив её буфер
+struct Command {
+  CommandId id;
+  int32_t ivalue;
+  float fvalue;
+  std::string_view word;
+  int32_t list[COMMAND_MAX_ARGS];
+  uint8_t list_len;
+};
+
+constexpr char to_upper(char c) {
+  return (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+}
+
+constexpr bool name_equals(std::string_view a, std::string_view b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (to_upper(a[i]) != to_upper(b[i]))
+      return false;
+  }
+  return true;
+}
+
+inline bool parse_int(std::string_view s, int32_t &out) {
+  if (!s.empty() && s.front() == '+')
+    s.remove_prefix(1);
+  auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+  return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+// Разбор десятичного числа вида [-]123.456 без локали и strtof
+inline bool parse_float(std::string_view s, float &out) {
+  bool negative = false;
+  if (!s.empty() && (s.front() == '-' || s.front() == '+')) {
+    negative = s.front() == '-';
+    s.remove_prefix(1);
+  }
+  size_t dot = s.find('.');
+  std::string_view int_part = s.substr(0, dot);
+  std::string_view frac_part =
+      dot == std::string_view::npos ? std::string_view() : s.substr(dot + 1);
+  if (int_part.empty() && frac_part.empty())
+    return false;
+
+  uint32_t whole = 0;
+  if (!int_part.empty()) {
+    auto res = std::from_chars(int_part.data(),
+                               int_part.data() + int_part.size(), whole);
+    if (res.ec != std::errc() || res.ptr != int_part.data() + int_part.size())
+      return false;
+  }
+
+  float value = static_cast<float>(whole);
+  float scale = 0.1f;
+  for (char c : frac_part) {
+    if (c < '0' || c > '9')
+      return false;
+    value += (c - '0') * scale;
+    scale *= 0.1f;
+  }
+  out = negative ? -value : value;
+  return true;
+}
+
+// Список целых через запятую: "1,-2,3"
+inline bool parse_int_list(std::string_view s, Command &cmd) {
+  cmd.list_len = 0;
+  while (!s.empty()) {
+    if (cmd.list_len == COMMAND_MAX_ARGS)
+      return false;
+    size_t comma = s.find(',');
+    if (!parse_int(s.substr(0, comma), cmd.list[cmd.list_len++]))
+      return false;
+    if (comma == std::string_view::npos)
+      break;
+    s.remove_prefix(comma + 1);
+  }
+  return cmd.list_len > 0;
+}
+
+inline bool parse_command(std::string_view line, Command &cmd) {
+  size_t colon = line.find(':');
+  std::string_view name = line.substr(0, colon);
+  std::string_view arg =
+      colon == std::string_view::npos ? std::string_view() : line.substr(colon + 1);
+
+  for (const CommandSpec &spec : COMMANDS) {
+    if (!name_equals(name, spec.name))
+      continue;
+
+    cmd = Command{spec.id, 0, 0.0f, arg, {}, 0};
+    switch (spec.arg) {
+    case ArgKind::None:
+      return colon == std::string_view::npos;
+    case ArgKind::Int:
+      return parse_int(arg, cmd.ivalue);
+    case ArgKind::Float:
+      return parse_float(arg, cmd.fvalue);
+    case ArgKind::Word:
+      return !arg.empty();
+    case ArgKind::IntList:
+      return parse_int_list(arg, cmd);
+    }
+  }
+  return false;
+}
+
+} // namespace ppm
@@ -0,0 +1,157 @@
+// Конфигурация, сохраняемая во флеше.
+//
+// Записи фиксированного размера пишутся по очереди в свободные страницы
+// двух секторов; действующая - с наибольшим порядковым номером и верной
+// CRC. Когда сектор заполнен, стирается другой, так что при пропадании
+// питания во время стирания последняя запись остаётся цела. Заголовок не
+// зависит от Pico SDK: доступ к флешу даёт параметр Flash.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "ppm_audio.h"
+#include "ppm_dsp.h"
+#include "ppm_timing.h"
+
+namespace ppm {
+
+constexpr uint32_t CONFIG_MAGIC = 0x50504D43; // "PPMC"
+constexpr uint16_t CONFIG_VERSION = 3;
+constexpr size_t CONFIG_RECORD_SIZE = 256;    // одна страница флеша
+constexpr size_t CONFIG_SECTOR_SIZE = 4096;
+constexpr size_t CONFIG_SLOTS = CONFIG_SECTOR_SIZE / CONFIG_RECORD_SIZE;
+
+struct DeviceConfig {
+  uint32_t magic;
+  uint32_t seq;
+  uint16_t version;
+  uint16_t size;
+  uint16_t sys_mhz;
+  uint8_t modulation;
+  uint8_t encoder;
+  uint8_t channel_map[2];
+  int16_t limiter;
+  uint16_t code;
+  uint8_t section_mask;
+  uint8_t buffer_profile; // индекс BUFFER_PROFILES
+  uint16_t idle_threshold;
+  uint32_t idle_frames;   // фреймов тишины до простоя, 0 - без простоя
+  uint16_t sync_interval; // фреймов между преамбулами, 0 - без преамбулы
+  CalibrationTable calibration;
+  BiquadCoeffs sections[DSP_MAX_SECTIONS];
+  uint32_t crc;
+};
+
+static_assert(sizeof(DeviceConfig) <= CONFIG_RECORD_SIZE,
+              "DeviceConfig must fit in one flash page");
+
+inline DeviceConfig default_config() {
+  DeviceConfig cfg{};
+  cfg.magic = CONFIG_MAGIC;
+  cfg.version = CONFIG_VERSION;
+  cfg.size = sizeof(DeviceConfig);
+  cfg.channel_map[0] = 0;
+  cfg.channel_map[1] = 1;
+  cfg.code = MAX_CODE / 2;
+  cfg.idle_frames = IDLE_DEFAULT_FRAMES;
+  cfg.idle_threshold = IDLE_DEFAULT_THRESHOLD;
+  return cfg;
+}
+
+inline uint32_t crc32(const uint8_t *data, size_t len) {
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int k = 0; k < 8; k++)
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+  }
+  return ~crc;
+}
+
+inline uint32_t config_crc(const DeviceConfig &cfg) {
+  return crc32(reinterpret_cast<const uint8_t *>(&cfg),
+               offsetof(DeviceConfig, crc));
+}
+
+inline bool config_valid(const DeviceConfig &cfg) {
+  return cfg.magic == CONFIG_MAGIC && cfg.version == CONFIG_VERSION &&
+         cfg.size == sizeof(DeviceConfig) && cfg.crc == config_crc(cfg);
+}
+
+// Flash должен предоставлять:
+//   const uint8_t *read(uint32_t offset)  - отображённая память
+//   void erase(uint32_t offset)           - стереть сектор
+//   void program(uint32_t offset, const uint8_t *data) - записать страницу
+// offset отсчитывается от начала области из двух секторов.
+template <typename Flash> class ConfigStore {
+public:
+  explicit ConfigStore(Flash &flash_) : flash(flash_) {}
+
+  // Найти последнюю верную запись; false - во флеше ничего нет
+  bool load(DeviceConfig &out) {
+    found = false;
+    for (uint32_t slot = 0; slot < 2 * CONFIG_SLOTS; slot++) {
+      DeviceConfig rec;
+      memcpy(&rec, flash.read(slot * CONFIG_RECORD_SIZE), sizeof(rec));
+      if (config_valid(rec) && (!found || seqNewer(rec.seq, out.seq))) {
+        out = rec;
+        lastSlot = slot;
+        found = true;
+      }
+    }
+    if (found)
+      seq = out.seq;
+    return found;
+  }
+
+  void save(DeviceConfig &cfg) {
+    uint32_t slot = found ? (lastSlot + 1) % (2 * CONFIG_SLOTS) : 0;
+    // Мусор в очередном слоте: переходим в другой сектор, не трогая тот,
+    // где лежит последняя запись
+    if (slot % CONFIG_SLOTS != 0 && !slotErased(slot))
+      slot = (slot / CONFIG_SLOTS + 1) % 2 * CONFIG_SLOTS;
+    if (slot % CONFIG_SLOTS == 0)
+      flash.erase(slot * CONFIG_RECORD_SIZE);
+    write(cfg, slot);
+  }
+
+  uint32_t getSeq() const { return seq; }
+
+private:
+  static bool seqNewer(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) > 0;
+  }
+
+  bool slotErased(uint32_t slot) {
+    const uint8_t *p = flash.read(slot * CONFIG_RECORD_SIZE);
+    for (size_t i = 0; i < CONFIG_RECORD_SIZE; i++) {
+      if (p[i] != 0xFF)
+        return false;
+    }
+    return true;
+  }
+
+  void write(DeviceConfig &cfg, uint32_t slot) {
+    cfg.magic = CONFIG_MAGIC;
+    cfg.version = CONFIG_VERSION;
+    cfg.size = sizeof(DeviceConfig);
+    cfg.seq = ++seq;
+    cfg.crc = config_crc(cfg);
+
+    uint8_t page[CONFIG_RECORD_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page, &cfg, sizeof(cfg));
+    flash.program(slot * CONFIG_RECORD_SIZE, page);
+    lastSlot = slot;
+    found = true;
+  }
+
+  Flash &flash;
+  uint32_t lastSlot = 0;
+  uint32_t seq = 0;
+  bool found = false;
+};
+
+} // namespace ppm
@@ -0,0 +1,576 @@
+// Ядро энкодера, общее для прошивки и эмулятора.
+//
+// Очередь отсчётов из потока, DSP, источник кодов, калибровка пауз,
+// простой с фреймами поддержки, преамбула синхронизации, тестовый режим и
+// замеры задержек. Здесь выбирается пауза следующего фрейма (nextGap) и
+// выполняются общие команды (handle_command); подача пауз в PIO, смена
+// частоты и программы, флеш и BENCH остаются у устройства (pico_ppm.cpp).
+// Заголовок не зависит от Pico SDK: время берётся из Clock, и эмулятор
+// (host/ppm_emulator.cpp) работает на том же ядре с часами хоста.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ppm_audio.h"
+#include "ppm_command.h"
+#include "ppm_config.h"
+#include "ppm_decoder.h"
+#include "ppm_dsp.h"
+#include "ppm_stream.h"
+#include "ppm_timing.h"
+
+namespace ppm {
+
+// Clock даёт:
+//   static uint32_t now_us()                 - микросекунды, по модулю 2^32
+//   static uint32_t cycles()                 - отметка для замера DSP
+//   static uint32_t cycles_since(uint32_t s) - тактов от отметки s
+template <size_t N, typename Clock> class EncoderCore {
+public:
+  explicit EncoderCore(uint32_t sys_khz)
+      : timing(make_timing_profile(sys_khz)), source(samples) {}
+
+  // Настройки из записи флеша; частота и программа - забота устройства
+  void apply(const DeviceConfig &config, uint32_t sys_khz) {
+    Modulation m = static_cast<Modulation>(config.modulation);
+    if (m != Modulation::Tdm || !modulation_fits(sys_khz, m))
+      m = Modulation::Mono;
+    source.setModulation(m);
+    source.setChannelMap(config.channel_map[0], config.channel_map[1]);
+    dsp.setChannels(modulation_slots(m));
+    for (size_t i = 0; i < DSP_MAX_SECTIONS; i++) {
+      if (config.section_mask & (1u << i))
+        dsp.eq.setSection(i, config.sections[i]);
+    }
+    dsp.limiter.setThreshold(config.limiter);
+    calibration = config.calibration;
+    setBufferProfile(config.buffer_profile);
+    setIdle(config.idle_frames, config.idle_threshold);
+    sendCode(config.code);
+    retime(sys_khz);
+    setSync(config.sync_interval);
+  }
+
+  void capture(DeviceConfig &config) const {
+    config.modulation = static_cast<uint8_t>(getModulation());
+    config.channel_map[0] = source.getChannelMap()[0];
+    config.channel_map[1] = source.getChannelMap()[1];
+    config.limiter = dsp.limiter.getThreshold();
+    config.code = currentCode;
+    config.section_mask = 0;
+    for (size_t i = 0; i < DSP_MAX_SECTIONS; i++) {
+      if (dsp.eq.getSection(i, config.sections[i]))
+        config.section_mask |= 1u << i;
+    }
+    config.calibration = calibration;
+    config.buffer_profile = bufferProfile;
+    config.idle_frames = idle.getFrames();
+    config.idle_threshold = idle.getThreshold();
+    config.sync_interval = syncInterval;
+  }
+
+  // Таблицы пауз под частоту sys_khz и текущую модуляцию. Преамбула,
+  // которая не помещается в новый фрейм, выключается
+  void retime(uint32_t sys_khz) {
+    timing = make_timing_profile(sys_khz, modulation_slots(getModulation()));
+    if (!sync_fits(timing)) {
+      syncInterval = 0;
+      syncCount = 0;
+    }
+  }
+
+  // Смена модуляции; вывод в это время должен стоять
+  void applyModulation(Modulation m) {
+    samples.clear();
+    source.setModulation(m);
+    dsp.setChannels(modulation_slots(m));
+    retime(timing.sys_khz);
+  }
+
+  bool setCalibration(size_t point, int32_t trim) {
+    if (point >= CALIBRATION_POINTS || trim < -128 || trim > 127)
+      return false;
+    calibration.trim[point] = static_cast<int8_t>(trim);
+    return true;
+  }
+
+  void setChannelMap(uint8_t left, uint8_t right) {
+    source.setChannelMap(left, right);
+  }
+
+  bool setBufferProfile(size_t index) {
+    if (index >= BUFFER_PROFILE_COUNT)
+      return false;
+    bufferProfile = static_cast<uint8_t>(index);
+    samples.setLimit(BUFFER_PROFILES[index].queue_depth);
+    markerLatencyMaxUs = 0;
+    return true;
+  }
+
+  const BufferProfile &getBufferProfile() const {
+    return BUFFER_PROFILES[bufferProfile];
+  }
+
+  bool setIdle(uint32_t frames, uint32_t threshold) {
+    if (threshold > MAX_CODE / 2)
+      return false;
+    idle.configure(frames, static_cast<uint16_t>(threshold));
+    wakeLatencyMaxUs = 0;
+    return true;
+  }
+
+  const IdleGate &getIdle() const { return idle; }
+  bool isIdle() const { return idle.isIdle(); }
+  uint32_t getWakeLatency() const { return wakeLatencyUs; }
+  uint32_t getWakeLatencyMax() const { return wakeLatencyMaxUs; }
+
+  // Преамбула раз в interval фреймов, 0 - выключена. При профиле, в
+  // который она не помещается (TDM), не включается
+  bool setSync(uint32_t interval) {
+    if (interval != 0 &&
+        (interval < SYNC_MIN_INTERVAL || interval > UINT16_MAX ||
+         !sync_fits(timing)))
+      return false;
+    syncInterval = static_cast<uint16_t>(interval);
+    syncCount = 0;
+    return true;
+  }
+
+  uint16_t getSyncInterval() const { return syncInterval; }
+  uint32_t getSyncsSent() const { return syncsSent; }
+
+  // Подача фреймов начинается заново: полная частота
+  void restartFeed() {
+    idle.reset();
+    wakePending = false;
+  }
+
+  // Тиков таймера до следующего фрейма; в простое - до фрейма поддержки
+  uint32_t getFrameTicks() const {
+    return idle.isIdle() ? timing.frame_ticks * IDLE_KEEPALIVE_PERIODS
+                         : timing.frame_ticks;
+  }
+
+  // То же в тактах: фрейм, с которого начался простой, растягивается до
+  // фрейма поддержки
+  uint32_t getFrameCycles() const {
+    return idle.isIdle() ? timing.frame_cycles * IDLE_KEEPALIVE_PERIODS
+                         : timing.frame_cycles;
+  }
+
+  // Код следующего фрейма: SYNC_CODE - преамбула. Она встаёт на место
+  // фрейма на границе пары TDM, его отсчёт выбрасывается (приёмник
+  // повторяет предыдущий). at_us - момент выхода фрейма на пин
+  uint16_t nextCode(uint32_t at_us) {
+    bool sync = syncInterval != 0 && ++syncCount >= syncInterval &&
+                source.atPairBoundary();
+    uint16_t code = frameCode(at_us);
+    if (!sync)
+      return code;
+    syncCount = 0;
+    syncsSent = syncsSent + 1;
+    return SYNC_CODE;
+  }
+
+  // Такты от начала первого импульса до начала второго для кода фрейма
+  uint32_t gapFor(uint16_t code) const {
+    return code == SYNC_CODE ? sync_gap(timing)
+                             : calibrated_gap(timing, calibration, code);
+  }
+
+  uint32_t nextGap(uint32_t at_us) { return gapFor(nextCode(at_us)); }
+
+  // Последний фрейм nextCode - фрейм поддержки простоя
+  bool wasKeepalive() const { return lastKeepalive; }
+
+  // Приём порции PCM из потока: обработка DSP на месте и запись в очередь
+  size_t write(int16_t *buf, size_t count) {
+    if (dsp.enabled()) {
+      uint32_t start = Clock::cycles();
+      dsp.process(buf, count);
+      dspCyclesLast = Clock::cycles_since(start);
+      dspBlockLast = static_cast<uint32_t>(count);
+      if (dspCyclesLast > dspCyclesMax)
+        dspCyclesMax = dspCyclesLast;
+    }
+    uint32_t index = samples.writeIndex();
+    size_t written = samples.write(buf, count);
+    // Момент прихода громкого отсчёта в простое - начало замера пробуждения
+    if (idle.isIdle() && !wakePending) {
+      for (size_t i = 0; i < written; i++) {
+        if (!idle.sampleSilent(buf[i])) {
+          wakeRequestUs = Clock::now_us();
+          wakePending = true;
+          break;
+        }
+      }
+    }
+    if (markerPending) {
+      markerPending = false;
+      if (written > 0)
+        source.armMarker(index);
+    }
+    return written;
+  }
+
+  // Следующий отсчёт - метка замера задержки; время приёма из потока
+  void mark() {
+    markerPending = true;
+    markerRxUs = Clock::now_us();
+  }
+
+  uint32_t getMarkerLatency() const { return markerLatencyUs; }
+  uint32_t getMarkerLatencyMax() const { return markerLatencyMaxUs; }
+
+  DspChain &getDsp() { return dsp; }
+  uint32_t getDspCyclesLast() const { return dspCyclesLast; }
+  uint32_t getDspCyclesMax() const { return dspCyclesMax; }
+  uint32_t getDspBlockLast() const { return dspBlockLast; }
+
+  Modulation getModulation() const { return source.getModulation(); }
+  SampleQueue<N> &getSamples() { return samples; }
+  const FrameSource<N> &getSource() const { return source; }
+  const TimingProfile &getTiming() const { return timing; }
+
+  void sendCode(uint16_t code) {
+    if (code > MAX_CODE)
+      code = MAX_CODE;
+    currentCode = code;
+  }
+
+  uint16_t getCurrentCode() const { return currentCode; }
+
+  // Тестовый режим: код по умолчанию пилой 1..MAX_CODE-1 с шагом раз в
+  // период обновления; вызывается из основного цикла
+  void testUpdate() {
+    uint32_t now = Clock::now_us();
+    if (!testMode) {
+      testNextUs = now;
+      return;
+    }
+    if (static_cast<int32_t>(now - testNextUs) < 0)
+      return;
+    currentCode += testDirection;
+    if (currentCode >= MAX_CODE - 1) {
+      currentCode = MAX_CODE - 1;
+      testDirection = -1;
+    } else if (currentCode <= 1) {
+      currentCode = 1;
+      testDirection = 1;
+    }
+    uint32_t update_ms =
+        static_cast<uint32_t>(testUpdatePeriodSeconds * 1000.0f);
+    testNextUs = now + update_ms * 1000;
+  }
+
+  void toggleTestMode() {
+    testMode = !testMode;
+    if (testMode) {
+      // При включении тестового режима пила начинается с нуля
+      currentCode = 0;
+      testDirection = 1;
+    }
+  }
+
+  void setTestUpdatePeriod(float seconds) {
+    if (seconds > 0.01f)
+      testUpdatePeriodSeconds = seconds;
+  }
+
+  bool isTestMode() const { return testMode; }
+  float getTestUpdatePeriod() const { return testUpdatePeriodSeconds; }
+
+private:
+  // Микросекунды от from до to; 0, если to раньше (момент фрейма взят
+  // до отметки запроса)
+  static uint32_t elapsedUs(uint32_t from, uint32_t to) {
+    int32_t d = static_cast<int32_t>(to - from);
+    return d > 0 ? static_cast<uint32_t>(d) : 0;
+  }
+
+  // Отсчёт из очереди или, если она пуста, текущий код; в простое - код
+  // фрейма поддержки
+  uint16_t frameCode(uint32_t at_us) {
+    lastKeepalive = idle.isIdle() && !wakeUp(at_us);
+    if (lastKeepalive) {
+      idle.noteKeepalive();
+      return source.keepalive(IDLE_CODE);
+    }
+    uint16_t code = source.next(currentCode);
+    if (source.takeMarker()) {
+      markerLatencyUs = elapsedUs(markerRxUs, at_us);
+      if (markerLatencyUs > markerLatencyMaxUs)
+        markerLatencyMaxUs = markerLatencyUs;
+    }
+    idle.noteFrame(idle.frameSilent(code, getModulation()),
+                   source.atPairBoundary());
+    return code;
+  }
+
+  // В простое: выйти, если в очереди громкий отсчёт (тихие выбрасываются)
+  // или громкий код по умолчанию
+  bool wakeUp(uint32_t at_us) {
+    auto silent = [this](int16_t s) { return idle.sampleSilent(s); };
+    bool loud = idle.getFrames() == 0 || source.drainSilence(silent) ||
+                !idle.codeSilent(currentCode);
+    if (!loud)
+      return false;
+    idle.wake();
+    if (wakePending) {
+      wakePending = false;
+      wakeLatencyUs = elapsedUs(wakeRequestUs, at_us);
+      if (wakeLatencyUs > wakeLatencyMaxUs)
+        wakeLatencyMaxUs = wakeLatencyUs;
+    }
+    return true;
+  }
+
+  TimingProfile timing;
+  SampleQueue<N> samples;
+  FrameSource<N> source;
+  DspChain dsp;
+  uint32_t dspCyclesLast = 0;
+  uint32_t dspCyclesMax = 0;
+  uint32_t dspBlockLast = 0;
+  CalibrationTable calibration{};
+  uint8_t bufferProfile = 0;
+  bool markerPending = false;
+  uint32_t markerRxUs = 0;
+  volatile uint32_t markerLatencyUs = 0;
+  volatile uint32_t markerLatencyMaxUs = 0;
+  IdleGate idle;
+  bool lastKeepalive = false;
+  volatile bool wakePending = false;
+  uint32_t wakeRequestUs = 0;
+  volatile uint32_t wakeLatencyUs = 0;
+  volatile uint32_t wakeLatencyMaxUs = 0;
+  uint16_t syncInterval = 0;
+  uint32_t syncCount = 0;
+  volatile uint32_t syncsSent = 0;
+  uint16_t currentCode = MAX_CODE / 2; // середина: пустая очередь - тишина
+  bool testMode = false;
+  int8_t testDirection = 1;
+  uint32_t testNextUs = 0;
+  float testUpdatePeriodSeconds = 0.001f;
+};
+
+// Выполнение разобранной команды над ядром устройства. Device даёт:
+//   core()                          - EncoderCore устройства
+//   bool setModulation(Modulation)  - false, если фрейм не помещается
+//   const char *encoderName()       - имя программы энкодера для S
+//   handleDevice(cmd, response)     - R, E, W и BENCH
+//   appendStats(response)           - поля S, которые есть только у него
+template <typename Device, size_t N>
+void handle_command(Device &dev, const Command &cmd, TextBuffer<N> &response) {
+  auto &core = dev.core();
+  const uint16_t sync = core.getSyncInterval();
+  switch (cmd.id) {
+  case CommandId::Test:
+    core.toggleTestMode();
+    response.str("\r\nРежим тестирования ")
+        .str(core.isTestMode() ? "включен" : "выключен")
+        .str("\r\n");
+    break;
+
+  case CommandId::Period:
+    core.setTestUpdatePeriod(cmd.fvalue);
+    response.str("\r\nПериод обновления установлен: ")
+        .fixed(core.getTestUpdatePeriod())
+        .str(" сек\r\n");
+    break;
+
+  case CommandId::Code: {
+    int32_t code = cmd.ivalue < 0 ? 0 : cmd.ivalue;
+    core.sendCode(code > MAX_CODE ? MAX_CODE : static_cast<uint16_t>(code));
+    response.str("\r\nPPM code sent: ")
+        .num(static_cast<uint32_t>(core.getCurrentCode()))
+        .str("\r\n");
+    break;
+  }
+
+  case CommandId::Modulation: {
+    Modulation m;
+    if (cmd.word == "mono") {
+      m = Modulation::Mono;
+    } else if (cmd.word == "tdm") {
+      m = Modulation::Tdm;
+    } else {
+      response.str("\r\nНеизвестная модуляция: ").str(cmd.word).str("\r\n");
+      break;
+    }
+    if (dev.setModulation(m)) {
+      response.str("\r\nМодуляция: ").str(cmd.word).str("\r\n");
+    } else {
+      response.str("\r\nМодуляция ")
+          .str(cmd.word)
+          .str(" не помещается во фрейм при ")
+          .num(core.getTiming().sys_khz / 1000)
+          .str(" МГц\r\n");
+    }
+    break;
+  }
+
+  case CommandId::Biquad: {
+    DspChain &dsp = core.getDsp();
+    size_t index = static_cast<size_t>(cmd.list[0]);
+    if (cmd.list_len == 1 && index < DSP_MAX_SECTIONS) {
+      dsp.eq.bypassSection(index);
+      response.str("\r\nСекция ").num(cmd.list[0]).str(" в обходе\r\n");
+      break;
+    }
+    BiquadCoeffs c{cmd.list[1], cmd.list[2], cmd.list[3], cmd.list[4],
+                   cmd.list[5]};
+    if (cmd.list_len == 6 && dsp.eq.setSection(index, c)) {
+      response.str("\r\nСекция ").num(cmd.list[0]).str(" установлена\r\n");
+    } else {
+      response.str("\r\nНедопустимая секция\r\n");
+    }
+    break;
+  }
+
+  case CommandId::Limiter:
+    if (cmd.ivalue >= 0 && cmd.ivalue <= 32767) {
+      core.getDsp().limiter.setThreshold(static_cast<int16_t>(cmd.ivalue));
+      response.str("\r\nПорог ограничителя: ").num(cmd.ivalue).str("\r\n");
+    } else {
+      response.str("\r\nНедопустимый порог\r\n");
+    }
+    break;
+
+  case CommandId::Calibrate:
+    if (cmd.list_len == 2 && core.setCalibration(cmd.list[0], cmd.list[1])) {
+      response.str("\r\nКалибровка: узел ")
+          .num(cmd.list[0])
+          .str(", поправка ")
+          .num(cmd.list[1])
+          .str("\r\n");
+    } else {
+      response.str("\r\nНедопустимая калибровка\r\n");
+    }
+    break;
+
+  case CommandId::ChannelMap:
+    if (cmd.list_len == 2 && (cmd.list[0] & ~1) == 0 &&
+        (cmd.list[1] & ~1) == 0) {
+      core.setChannelMap(cmd.list[0], cmd.list[1]);
+      response.str("\r\nКаналы: L<-")
+          .num(cmd.list[0])
+          .str(" R<-")
+          .num(cmd.list[1])
+          .str("\r\n");
+    } else {
+      response.str("\r\nНедопустимая карта каналов\r\n");
+    }
+    break;
+
+  case CommandId::Buffering: {
+    int index = find_buffer_profile(cmd.word);
+    if (index >= 0 && core.setBufferProfile(index)) {
+      const BufferProfile &profile = core.getBufferProfile();
+      response.str("\r\nБуферизация: ")
+          .str(profile.name)
+          .str(", очередь ")
+          .num(static_cast<uint32_t>(profile.queue_depth))
+          .str(", чтение ")
+          .num(static_cast<uint32_t>(profile.read_size))
+          .str(" байт, блок ")
+          .num(static_cast<uint32_t>(profile.block_size))
+          .str("\r\n");
+    } else {
+      response.str("\r\nНеизвестный профиль: ").str(cmd.word).str("\r\n");
+    }
+    break;
+  }
+
+  case CommandId::Idle: {
+    int32_t threshold =
+        cmd.list_len > 1 ? cmd.list[1] : core.getIdle().getThreshold();
+    if (cmd.list_len <= 2 && cmd.list[0] >= 0 && threshold >= 0 &&
+        core.setIdle(cmd.list[0], threshold)) {
+      response.str("\r\nПростой: после ")
+          .num(cmd.list[0])
+          .str(" фреймов тишины, порог ")
+          .num(threshold)
+          .str(" кодов\r\n");
+    } else {
+      response.str("\r\nНедопустимые параметры простоя\r\n");
+    }
+    break;
+  }
+
+  case CommandId::Sync:
+    if (cmd.ivalue >= 0 && core.setSync(static_cast<uint32_t>(cmd.ivalue))) {
+      response.str("\r\nПреамбула: ");
+      if (cmd.ivalue == 0)
+        response.str("выключена\r\n");
+      else
+        response.str("раз в ").num(cmd.ivalue).str(" фреймов\r\n");
+    } else {
+      response.str("\r\nНедопустимый период преамбулы\r\n");
+    }
+    break;
+
+  case CommandId::Stats:
+    response.str("\r\nsys_mhz=")
+        .num(core.getTiming().sys_khz / 1000)
+        .str(" encoder=")
+        .str(dev.encoderName())
+        .str(" mode=")
+        .str(core.getModulation() == Modulation::Tdm ? "tdm" : "mono")
+        .str(" buffer=")
+        .str(core.getBufferProfile().name)
+        .str(" queued=")
+        .num(static_cast<uint32_t>(core.getSamples().size()))
+        .str(" underruns=")
+        .num(core.getSource().getUnderruns())
+        .str(" dsp_block=")
+        .num(core.getDspBlockLast())
+        .str(" dsp_cycles=")
+        .num(core.getDspCyclesLast())
+        .str(" dsp_cycles_max=")
+        .num(core.getDspCyclesMax())
+        .str(" marker_us=")
+        .num(core.getMarkerLatency())
+        .str(" marker_max_us=")
+        .num(core.getMarkerLatencyMax())
+        .str(" idle=")
+        .str(core.isIdle() ? "on" : "off")
+        .str(" idle_pct=")
+        .num(core.getIdle().idlePercent())
+        .str(" idle_entries=")
+        .num(core.getIdle().getEntries())
+        .str(" wake_us=")
+        .num(core.getWakeLatency())
+        .str(" wake_max_us=")
+        .num(core.getWakeLatencyMax())
+        .str(" sync=")
+        .num(static_cast<uint32_t>(core.getSyncInterval()))
+        .str(" syncs=")
+        .num(core.getSyncsSent());
+    dev.appendStats(response);
+    response.str("\r\n");
+    break;
+
+  default:
+    dev.handleDevice(cmd, response);
+    break;
+  }
+  // M и R меняют фрейм: выключенную ими преамбулу видно в ответе
+  if (sync != 0 && core.getSyncInterval() == 0 && cmd.id != CommandId::Sync)
+    response.str("Преамбула выключена: не помещается во фрейм\r\n");
+}
+
+// Строка из потока: команда или сообщение о нераспознанной
+template <typename Device, size_t L, size_t N>
+void handle_line(Device &dev, const LineBuffer<L> &line,
+                 TextBuffer<N> &response) {
+  Command cmd;
+  if (!line.overflowed() && parse_command(line.view(), cmd)) {
+    handle_command(dev, cmd, response);
+  } else {
+    response.str("\r\nНераспознанная команда: ").str(line.view()).str("\r\n");
+  }
+}
+
+} // namespace ppm
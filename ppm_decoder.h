@@ -0,0 +1,480 @@
+// Декодер PPM: восстановление кодов по моментам импульсов.
+//
+// На вход подаются метки времени передних фронтов в тактах энкодера.
+// Фрейм - пара импульсов, интервал между которыми лежит в пределах
+// [min_gap, max_gap] (см. code_gap в ppm_timing.h). Без захвата любой
+// импульс считается кандидатом в начало фрейма; захват наступает после
+// нескольких подряд пар, начала которых отстоят на период фрейма. В
+// захвате начало следующего фрейма ожидается через период +- допуск.
+// Фреймы поддержки связи простого энкодера (через keepalive_periods
+// периодов) держат захват и не считаются потерями. Преамбула (интервал
+// sync_gap, см. ppm_timing.h) заменяет серию: захват наступает на
+// следующем за ней фрейме, пришедшем через период.
+// Заголовок не зависит от Pico SDK и используется и на хосте.
+#pragma once
+
+#include <cstdint>
+
+#include "ppm_audio.h"
+#include "ppm_timing.h"
+
+namespace ppm {
+
+struct DecoderConfig {
+  uint32_t min_gap;          // минимальный интервал импульсов фрейма, такты
+  uint32_t max_gap;          // максимальный интервал импульсов фрейма, такты
+  uint32_t period;           // период фреймов, такты
+  uint32_t tolerance;        // допуск на начало фрейма, такты
+  uint8_t lock_frames;       // пар подряд для захвата
+  uint8_t max_misses;        // пропущенных фреймов подряд до потери захвата
+  uint8_t keepalive_periods; // период фреймов простоя, 0 - не ожидаются
+  uint32_t sync_gap;         // интервал преамбулы, такты; 0 - не ожидается
+  uint32_t quantum;          // шаг меток времени, такты
+};
+
+// quantum - через сколько тактов энкодера отсчитывается вход. Метка
+// фронта запаздывает до quantum - 1 такта, поэтому интервал расходится с
+// переданным меньше чем на quantum в обе стороны: границы интервала и
+// допуск расширяются на столько же, код округляется к краю шкалы
+inline DecoderConfig make_decoder_config(const TimingProfile &t,
+                                         uint32_t quantum = 1) {
+  return DecoderConfig{min_gap(t),
+                       max_gap(t),
+                       t.frame_cycles,
+                       frame_tolerance(t) + quantum - 1,
+                       4,
+                       8,
+                       static_cast<uint8_t>(IDLE_KEEPALIVE_PERIODS),
+                       sync_fits(t) ? sync_gap(t) : 0,
+                       quantum};
+}
+
+struct Frame {
+  uint32_t start; // метка первого импульса
+  uint16_t code;
+};
+
+// Код фрейма преамбулы: отсчёта он не несёт
+constexpr uint16_t SYNC_CODE = UINT16_MAX;
+
+struct DecoderStats {
+  uint32_t frames = 0;    // декодировано фреймов
+  uint32_t lost = 0;      // пропущено фреймов в захвате
+  uint32_t spurious = 0;  // лишних импульсов
+  uint32_t keepalive = 0; // фреймов простоя энкодера
+  uint32_t sync = 0;      // преамбул
+  uint32_t lock_count = 0;
+  uint32_t sync_locks = 0;      // из них захватов по преамбуле
+  uint32_t lock_cycles = 0;     // время до последнего захвата, такты
+  uint32_t lock_cycles_max = 0; // с первого импульса без захвата
+};
+
+class FrameDecoder {
+public:
+  explicit FrameDecoder(const DecoderConfig &cfg_) : cfg(cfg_) {}
+
+  void reset() {
+    locked = false;
+    haveStart = false;
+    searching = false;
+    afterSync = false;
+    streak = 0;
+  }
+
+  bool isLocked() const { return locked; }
+  const DecoderStats &getStats() const { return stats; }
+  const DecoderConfig &getConfig() const { return cfg; }
+
+  // Обработать импульс; true, если завершён фрейм (записан в out)
+  bool push(uint32_t t, Frame &out) {
+    return locked ? pushLocked(t, out) : pushUnlocked(t, out);
+  }
+
+private:
+  bool gapValid(uint32_t gap) const {
+    return gap + cfg.quantum > cfg.min_gap && gap < cfg.max_gap + cfg.quantum;
+  }
+
+  bool spacingIs(uint32_t spacing, uint32_t periods) const {
+    uint32_t expected = cfg.period * periods;
+    return spacing + cfg.tolerance >= expected &&
+           spacing <= expected + cfg.tolerance;
+  }
+
+  bool isSync(uint32_t gap) const {
+    return cfg.sync_gap != 0 && gap + cfg.tolerance >= cfg.sync_gap &&
+           gap <= cfg.sync_gap + cfg.tolerance;
+  }
+
+  bool emit(uint32_t gap, Frame &out) {
+    out.start = start;
+    if (gap < cfg.min_gap)
+      gap = cfg.min_gap;
+    else if (gap > cfg.max_gap)
+      gap = cfg.max_gap;
+    out.code = static_cast<uint16_t>(gap - cfg.min_gap);
+    stats.frames++;
+    haveStart = false;
+    return true;
+  }
+
+  bool emitSync(Frame &out) {
+    out.start = start;
+    out.code = SYNC_CODE;
+    stats.sync++;
+    haveStart = false;
+    return true;
+  }
+
+  void lock(uint32_t t) {
+    locked = true;
+    misses = 0;
+    nextStart = start + cfg.period;
+    stats.lock_count++;
+    stats.lock_cycles = t - searchStart;
+    if (stats.lock_cycles > stats.lock_cycles_max)
+      stats.lock_cycles_max = stats.lock_cycles;
+  }
+
+  bool pushUnlocked(uint32_t t, Frame &out) {
+    if (!searching) {
+      searching = true;
+      searchStart = t;
+    }
+    if (haveStart && isSync(t - start)) {
+      // Начало фрейма известно; одна пара может быть и случайной, поэтому
+      // захват - если через период придёт фрейм
+      stats.sync++;
+      streak = static_cast<uint8_t>(cfg.lock_frames - 1);
+      afterSync = true;
+      lastStart = start;
+      haveStart = false;
+      return false;
+    }
+    if (!haveStart || !gapValid(t - start)) {
+      start = t;
+      haveStart = true;
+      return false;
+    }
+
+    uint32_t spacing = start - lastStart;
+    if (streak > 0 &&
+        (spacingIs(spacing, 1) ||
+         (cfg.keepalive_periods > 1 &&
+          spacingIs(spacing, cfg.keepalive_periods)))) {
+      streak++;
+    } else {
+      streak = 1;
+      afterSync = false;
+    }
+    lastStart = start;
+    if (streak >= cfg.lock_frames) {
+      lock(t);
+      stats.sync_locks += afterSync;
+      afterSync = false;
+    }
+    return emit(t - start, out);
+  }
+
+  bool pushLocked(uint32_t t, Frame &out) {
+    if (haveStart) {
+      uint32_t gap = t - start;
+      if (gap + cfg.quantum <= cfg.min_gap) {
+        stats.spurious++;
+        return false;
+      }
+      if (gap < cfg.max_gap + cfg.quantum) {
+        misses = 0;
+        return emit(gap, out);
+      }
+      if (isSync(gap)) {
+        misses = 0;
+        return emitSync(out);
+      }
+      // Второй импульс потерян, t может быть началом следующего фрейма
+      haveStart = false;
+      stats.lost++;
+    }
+
+    int32_t early = static_cast<int32_t>(nextStart - t);
+    if (early > static_cast<int32_t>(cfg.tolerance)) {
+      stats.spurious++;
+      return false;
+    }
+    // Пропущенные фреймы: сдвигаем ожидание на целое число периодов
+    const uint32_t limit = cfg.max_misses + cfg.keepalive_periods;
+    uint32_t skipped = 0;
+    while (skipped <= limit && static_cast<int32_t>(t - nextStart) >
+                                   static_cast<int32_t>(cfg.tolerance)) {
+      nextStart += cfg.period;
+      skipped++;
+    }
+    if (skipped > 0 && cfg.keepalive_periods > 1 &&
+        skipped == cfg.keepalive_periods - 1u) {
+      stats.keepalive++;
+    } else if (skipped > 0) {
+      stats.lost += skipped;
+      misses = static_cast<uint8_t>(misses + skipped);
+      if (misses > cfg.max_misses) {
+        reset();
+        return pushUnlocked(t, out);
+      }
+    }
+    if (static_cast<int32_t>(nextStart - t) > static_cast<int32_t>(cfg.tolerance)) {
+      stats.spurious++;
+      return false;
+    }
+    start = t;
+    haveStart = true;
+    // Следим за фактическим началом, чтобы не копить уход частоты
+    nextStart = t + cfg.period;
+    return false;
+  }
+
+  DecoderConfig cfg;
+  DecoderStats stats;
+  bool locked = false;
+  bool haveStart = false;
+  bool searching = false; // идёт поиск захвата с searchStart
+  bool afterSync = false;  // серия начата преамбулой
+  uint32_t searchStart = 0;
+  uint32_t start = 0;
+  uint32_t lastStart = 0;
+  uint32_t nextStart = 0;
+  uint8_t streak = 0;
+  uint8_t misses = 0;
+};
+
+// Разнесённый приём: фреймы одного энкодера с нескольких входов (каждый
+// со своим FrameDecoder) сводятся в один поток. Фреймы разных входов,
+// начавшиеся в пределах четверти периода, относятся к одному слоту.
+// Предпочтение - фреймам, принятым в захвате (прошли проверку периода;
+// проверку интервала проходит любой фрейм декодера); если таких
+// несколько, коды усредняются; преамбула хотя бы одного входа делает
+// преамбулой весь слот. Пока какой-то вход в захвате, слот без его
+// фрейма открыт шумом другого входа и отбрасывается целиком. Сведение
+// идёт блоками: вход накапливает фреймы, combine закрывает все слоты,
+// которые уже не может дополнить ни один вход.
+constexpr size_t DIVERSITY_MAX_INPUTS = 4;
+
+struct DiversityStats {
+  uint32_t frames = 0;   // сведённых фреймов
+  uint32_t merged = 0;   // из них усреднено по нескольким входам
+  uint32_t disagree = 0; // коды входов разошлись больше чем на 1
+  uint32_t lost = 0;     // слотов, пропущенных всеми входами
+  uint32_t missed[DIVERSITY_MAX_INPUTS] = {};   // слотов без фрейма входа
+  uint32_t rejected[DIVERSITY_MAX_INPUTS] = {}; // фрейм вне захвата отброшен
+  uint32_t overflow[DIVERSITY_MAX_INPUTS] = {}; // переполнение буфера входа
+};
+
+template <size_t Inputs, size_t Capacity> class DiversityCombiner {
+  static_assert(Inputs >= 1 && Inputs <= DIVERSITY_MAX_INPUTS,
+                "unsupported number of inputs");
+
+public:
+  explicit DiversityCombiner(uint32_t period_)
+      : period(period_), window(period_ / 4) {}
+
+  void reset() {
+    for (size_t i = 0; i < Inputs; i++) {
+      count[i] = 0;
+      holding[i] = false;
+    }
+    haveLast = false;
+  }
+
+  const DiversityStats &getStats() const { return stats; }
+
+  // Фрейм входа в порядке времени; locked - декодер входа в захвате
+  bool push(size_t input, const Frame &frame, bool locked) {
+    if (count[input] >= Capacity) {
+      stats.overflow[input]++;
+      return false;
+    }
+    pending[input][count[input]++] = Candidate{frame, locked};
+    return true;
+  }
+
+  // Закрыть слоты, начавшиеся не позже чем за период до horizon (все
+  // входы обработаны до этой метки); сведённые фреймы - в out, не больше
+  // max. Возвращает число записанных фреймов.
+  size_t combine(uint32_t horizon, Frame *out, size_t max) {
+    size_t head[Inputs] = {};
+    size_t produced = 0;
+    while (produced < max) {
+      // Самый ранний фрейм среди входов задаёт слот
+      size_t first = Inputs;
+      for (size_t i = 0; i < Inputs; i++) {
+        if (head[i] < count[i] &&
+            (first == Inputs || before(pending[i][head[i]].frame.start,
+                                       pending[first][head[first]].frame.start)))
+          first = i;
+      }
+      if (first == Inputs)
+        break;
+      const uint32_t slot = pending[first][head[first]].frame.start;
+      if (static_cast<int32_t>(horizon - slot) < static_cast<int32_t>(period))
+        break;
+
+      const Candidate *in[Inputs] = {};
+      bool anyLocked = false;
+      for (size_t i = 0; i < Inputs; i++) {
+        if (head[i] < count[i] &&
+            pending[i][head[i]].frame.start - slot <= window) {
+          in[i] = &pending[i][head[i]++];
+          anyLocked |= in[i]->locked;
+        }
+      }
+      for (size_t i = 0; i < Inputs; i++) {
+        if (in[i])
+          hold(i, *in[i]);
+      }
+      if (!anyLocked && lockHeld(slot)) {
+        for (size_t i = 0; i < Inputs; i++)
+          stats.rejected[i] += in[i] != nullptr;
+        continue;
+      }
+      out[produced++] = select(in, anyLocked);
+    }
+
+    // Незакрытые фреймы - в начало буферов
+    for (size_t i = 0; i < Inputs; i++) {
+      size_t left = count[i] - head[i];
+      for (size_t k = 0; k < left; k++)
+        pending[i][k] = pending[i][head[i] + k];
+      count[i] = left;
+    }
+    return produced;
+  }
+
+private:
+  struct Candidate {
+    Frame frame;
+    bool locked;
+  };
+
+  static bool before(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+  }
+
+  // Вход считается в захвате до следующего фрейма, но не дольше паузы
+  // простоя энкодера: пропавший сигнал не держит остальные входы
+  void hold(size_t i, const Candidate &c) {
+    holding[i] = c.locked;
+    holdUntil[i] = c.frame.start + (IDLE_KEEPALIVE_PERIODS + 1) * period;
+  }
+
+  bool lockHeld(uint32_t slot) const {
+    for (size_t i = 0; i < Inputs; i++) {
+      if (holding[i] && before(slot, holdUntil[i]))
+        return true;
+    }
+    return false;
+  }
+
+  Frame select(const Candidate *const *in, bool anyLocked) {
+    Frame result{};
+    uint32_t sum = 0;
+    uint16_t lo = UINT16_MAX, hi = 0;
+    uint32_t used = 0, codes = 0;
+    bool sync = false;
+    for (size_t i = 0; i < Inputs; i++) {
+      if (!in[i]) {
+        stats.missed[i]++;
+        continue;
+      }
+      if (anyLocked && !in[i]->locked) {
+        stats.rejected[i]++;
+        continue;
+      }
+      // Начало слота - по первому принятому входу
+      if (used++ == 0)
+        result.start = in[i]->frame.start;
+      uint16_t code = in[i]->frame.code;
+      if (code == SYNC_CODE) {
+        sync = true;
+        continue;
+      }
+      codes++;
+      sum += code;
+      lo = code < lo ? code : lo;
+      hi = code > hi ? code : hi;
+    }
+    result.code = sync ? SYNC_CODE
+                       : static_cast<uint16_t>((sum + codes / 2) / codes);
+    if (used > 1)
+      stats.merged++;
+    if ((sync && codes > 0) || (codes > 1 && hi - lo > 1))
+      stats.disagree++;
+
+    if (haveLast) {
+      // Фреймы простоя энкодера идут через IDLE_KEEPALIVE_PERIODS периодов
+      uint32_t periods = (result.start - lastStart + period / 2) / period;
+      if (periods > 1 && periods != IDLE_KEEPALIVE_PERIODS)
+        stats.lost += periods - 1;
+    }
+    haveLast = true;
+    lastStart = result.start;
+    stats.frames++;
+    return result;
+  }
+
+  uint32_t period;
+  uint32_t window;
+  Candidate pending[Inputs][Capacity];
+  size_t count[Inputs] = {};
+  bool holding[Inputs] = {};    // последний сведённый фрейм входа в захвате
+  uint32_t holdUntil[Inputs] = {};
+  bool haveLast = false;
+  uint32_t lastStart = 0;
+  DiversityStats stats;
+};
+
+// Разделение потока кодов TDM на стереопары. Левый слот узнаётся по
+// диапазону кода, поэтому пара собирается с любого места потока.
+// Преамбула занимает место левого слота; правый слот её пары отбрасывается.
+class TdmDeinterleaver {
+public:
+  // true, если собрана пара (left, right)
+  bool push(uint16_t code, int16_t &left, int16_t &right) {
+    if (code == SYNC_CODE) {
+      haveLeft = false;
+      afterSync = true;
+      return false;
+    }
+    if (tdm_code_slot(code) == TdmSlot::Left) {
+      if (haveLeft)
+        orphans++;
+      // Интервал до max_gap даёт код MAX_CODE: дрожание на такт у
+      // полной шкалы не должно перевернуть отсчёт
+      uint16_t slot = static_cast<uint16_t>(code - TDM_SLOT_RANGE);
+      if (slot >= TDM_SLOT_RANGE)
+        slot = TDM_SLOT_RANGE - 1;
+      pendingLeft = code_to_pcm(slot, TDM_SLOT_RANGE);
+      haveLeft = true;
+      afterSync = false;
+      return false;
+    }
+    if (!haveLeft) {
+      if (!afterSync)
+        orphans++;
+      afterSync = false;
+      return false;
+    }
+    haveLeft = false;
+    left = pendingLeft;
+    right = code_to_pcm(code, TDM_SLOT_RANGE);
+    return true;
+  }
+
+  // Слоты без пары (потерянный фрейм одного из каналов)
+  uint32_t getOrphans() const { return orphans; }
+
+private:
+  int16_t pendingLeft = 0;
+  bool haveLeft = false;
+  bool afterSync = false;
+  uint32_t orphans = 0;
+};
+
+} // namespace ppm
@@ -0,0 +1,255 @@
+// Обработка отсчётов перед кодированием: каскад биквадов с фиксированной
+// точкой (предыскажение, полочные фильтры) и блочный ограничитель.
+//
+// Рассчитано на Cortex-M0+: только 32-битные умножения, коэффициенты
+// Q2.13 считаются на хосте (dsp_design.py). Отсчёты идут блоками прямо
+// в чередующемся буфере L,R,..., у каждого канала своё состояние.
+// На приёмной стороне тот же класс с обратными коэффициентами даёт
+// компенсирующее восстановление. Заголовок не зависит от Pico SDK;
+// dsp_design.py повторяет арифметику бит в бит.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ppm {
+
+constexpr int DSP_COEF_SHIFT = 13;
+constexpr int32_t DSP_COEF_ONE = 1 << DSP_COEF_SHIFT;
+// Сумма модулей коэффициентов секции, при которой аккумулятор int32
+// не переполняется: 65535 * 32768 + 8191 < 2^31
+constexpr int32_t DSP_COEF_SUM_MAX = 65535;
+// Каждый коэффициент - Q2.13 в диапазоне int16, иначе сумма ниже сама
+// может переполниться
+constexpr int32_t DSP_COEF_MIN = INT16_MIN;
+constexpr int32_t DSP_COEF_MAX = INT16_MAX;
+constexpr size_t DSP_MAX_SECTIONS = 4;
+constexpr size_t DSP_MAX_CHANNELS = 2;
+
+// y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2, коэффициенты Q2.13
+struct BiquadCoeffs {
+  int32_t b0, b1, b2, a1, a2;
+};
+
+constexpr int16_t saturate16(int32_t v) {
+  return v > 32767 ? 32767 : (v < -32768 ? -32768 : static_cast<int16_t>(v));
+}
+
+// Только для значений в диапазоне int16
+constexpr int32_t iabs(int32_t v) { return v < 0 ? -v : v; }
+
+constexpr bool biquad_coef_in_range(int32_t v) {
+  return v >= DSP_COEF_MIN && v <= DSP_COEF_MAX;
+}
+
+constexpr bool biquad_coeffs_valid(const BiquadCoeffs &c) {
+  return biquad_coef_in_range(c.b0) && biquad_coef_in_range(c.b1) &&
+         biquad_coef_in_range(c.b2) && biquad_coef_in_range(c.a1) &&
+         biquad_coef_in_range(c.a2) &&
+         iabs(c.b0) + iabs(c.b1) + iabs(c.b2) + iabs(c.a1) + iabs(c.a2) <=
+             DSP_COEF_SUM_MAX;
+}
+
+static_assert(!biquad_coeffs_valid({0, INT32_MIN, 0, 0, 0}),
+              "INT32_MIN не должен проходить проверку");
+static_assert(!biquad_coeffs_valid({0, 1 << 30, 1 << 30, 0, 0}),
+              "переполнение суммы не должно проходить проверку");
+
+class BiquadCascade {
+public:
+  bool setSection(size_t index, const BiquadCoeffs &c) {
+    if (index >= DSP_MAX_SECTIONS || !biquad_coeffs_valid(c))
+      return false;
+    coeffs[index] = c;
+    active[index] = true;
+    reset();
+    return true;
+  }
+
+  // false, если секция в обходе
+  bool getSection(size_t index, BiquadCoeffs &c) const {
+    if (index >= DSP_MAX_SECTIONS || !active[index])
+      return false;
+    c = coeffs[index];
+    return true;
+  }
+
+  void bypassSection(size_t index) {
+    if (index < DSP_MAX_SECTIONS)
+      active[index] = false;
+  }
+
+  size_t activeSections() const {
+    size_t n = 0;
+    for (bool a : active)
+      n += a;
+    return n;
+  }
+
+  void reset() {
+    for (auto &section : state)
+      for (auto &s : section)
+        s = State{};
+  }
+
+  // Обработка на месте; phase - канал первого отсчёта буфера
+  void process(int16_t *buf, size_t count, size_t channels, size_t phase) {
+    for (size_t k = 0; k < DSP_MAX_SECTIONS; k++) {
+      if (!active[k])
+        continue;
+      const BiquadCoeffs c = coeffs[k];
+      for (size_t ch = 0; ch < channels; ch++) {
+        size_t first = (ch + channels - phase % channels) % channels;
+        State s = state[k][ch];
+        for (size_t i = first; i < count; i += channels) {
+          int32_t x = buf[i];
+          int32_t acc = c.b0 * x + c.b1 * s.x1 + c.b2 * s.x2 - c.a1 * s.y1 -
+                        c.a2 * s.y2 + s.err;
+          int32_t y = acc >> DSP_COEF_SHIFT;
+          // Остаток округления переносится в следующий отсчёт
+          s.err = acc - (y << DSP_COEF_SHIFT);
+          y = saturate16(y);
+          s.x2 = s.x1;
+          s.x1 = x;
+          s.y2 = s.y1;
+          s.y1 = y;
+          buf[i] = static_cast<int16_t>(y);
+        }
+        state[k][ch] = s;
+      }
+    }
+  }
+
+private:
+  struct State {
+    int32_t x1 = 0, x2 = 0, y1 = 0, y2 = 0, err = 0;
+  };
+
+  BiquadCoeffs coeffs[DSP_MAX_SECTIONS] = {};
+  bool active[DSP_MAX_SECTIONS] = {};
+  State state[DSP_MAX_SECTIONS][DSP_MAX_CHANNELS];
+};
+
+// Ограничитель с расчётом усиления раз на блок: мгновенная атака по пику
+// блока (одно деление на блок), экспоненциальный отпуск между блоками.
+// Каналы связаны общим усилением, чтобы не смещать стереопанораму.
+class BlockLimiter {
+public:
+  static constexpr int32_t UNITY = 1 << 15;
+
+  // threshold - допустимый пик отсчёта, 0 - ограничитель выключен
+  void setThreshold(int16_t threshold_) {
+    threshold = threshold_ < 0 ? 0 : threshold_;
+    gain = UNITY;
+  }
+  int16_t getThreshold() const { return threshold; }
+
+  void process(int16_t *buf, size_t count) {
+    if (threshold == 0 || count == 0)
+      return;
+    int32_t peak = 0;
+    for (size_t i = 0; i < count; i++) {
+      int32_t a = iabs(buf[i]);
+      if (a > peak)
+        peak = a;
+    }
+    int32_t target =
+        peak > threshold ? (static_cast<int32_t>(threshold) << 15) / peak
+                         : UNITY;
+    if (target < gain) {
+      gain = target;
+    } else {
+      // Шаг отпуска, пока он не обнулится, затем сразу до цели
+      int32_t step = (target - gain) >> RELEASE_SHIFT;
+      gain = step > 0 ? gain + step : target;
+    }
+    if (gain == UNITY)
+      return;
+    for (size_t i = 0; i < count; i++) {
+      buf[i] = static_cast<int16_t>((buf[i] * gain) >> 15);
+    }
+  }
+
+private:
+  static constexpr int RELEASE_SHIFT = 4;
+
+  int16_t threshold = 0;
+  int32_t gain = UNITY;
+};
+
+class DspChain {
+public:
+  BiquadCascade eq;
+  BlockLimiter limiter;
+
+  void setChannels(size_t channels_) {
+    channels = channels_ > DSP_MAX_CHANNELS ? DSP_MAX_CHANNELS : channels_;
+    reset();
+  }
+
+  void reset() {
+    eq.reset();
+    phase = 0;
+  }
+
+  bool enabled() const {
+    return eq.activeSections() > 0 || limiter.getThreshold() != 0;
+  }
+
+  void process(int16_t *buf, size_t count) {
+    eq.process(buf, count, channels, phase);
+    limiter.process(buf, count);
+    phase = (phase + count) % channels;
+  }
+
+private:
+  size_t channels = 1;
+  size_t phase = 0;
+};
+
+// Наборы dsp_design.py (вывод без аргументов): предыскажение 50/15 мкс с
+// полками на передатчике, обратные секции в обратном порядке на приёмнике.
+// Фильтры рассчитаны на действительную частоту отсчётов энкодера, поэтому
+// набор выбирается по числу каналов: [0] - моно (37037 Гц), [1] - TDM
+// (38462 Гц на канал). После изменения dsp_design.py числа переносятся сюда
+constexpr size_t DSP_PRESET_SECTIONS = 3;
+constexpr BiquadCoeffs DSP_TX_PRESET[DSP_MAX_CHANNELS][DSP_PRESET_SECTIONS] = {
+    {
+        {18252, -10492, 0, -431, 0},
+        {8175, -16170, 7997, -16170, 7981},
+        {9325, -2953, 1766, -1509, 1455},
+    },
+    {
+        {18432, -10825, 0, -585, 0},
+        {8176, -16178, 8004, -16178, 7988},
+        {9357, -3512, 1839, -1999, 1492},
+    },
+};
+constexpr int16_t DSP_TX_PRESET_LIMITER = 30000;
+constexpr BiquadCoeffs DSP_RX_PRESET[DSP_MAX_CHANNELS][DSP_PRESET_SECTIONS] = {
+    {
+        {7197, -1326, 1278, -2594, 1551},
+        {8209, -16203, 7997, -16204, 8014},
+        {3677, -194, 0, -4709, 0},
+    },
+    {
+        {7172, -1750, 1306, -3074, 1610},
+        {8208, -16210, 8004, -16210, 8020},
+        {3641, -260, 0, -4811, 0},
+    },
+};
+
+// Набор в первые секции каскада, остальные в обходе
+inline bool load_dsp_preset(DspChain &chain, const BiquadCoeffs *sections,
+                            int16_t limiter) {
+  for (size_t i = 0; i < DSP_MAX_SECTIONS; i++) {
+    if (i >= DSP_PRESET_SECTIONS)
+      chain.eq.bypassSection(i);
+    else if (!chain.eq.setSection(i, sections[i]))
+      return false;
+  }
+  chain.limiter.setThreshold(limiter);
+  return true;
+}
+
+} // namespace ppm
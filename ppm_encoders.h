@@ -0,0 +1,97 @@
+// Реестр PIO-программ энкодера.
+//
+// Все программы по возможности держатся в памяти инструкций PIO
+// одновременно; если места не хватает, неактивные программы выгружаются
+// и загружаются заново при переключении.
+#pragma once
+
+#include <cstring>
+
+#include "hardware/pio.h"
+
+#include "ppm.pio.h"
+
+namespace ppm {
+
+// Кто задаёт моменты фреймов
+enum class EncoderFeed : uint8_t {
+  Timer,     // таймер CPU раз в фрейм кладёт слово паузы
+  SelfTimed, // PIO сама выдерживает период, CPU лишь пополняет FIFO
+  CpuPulse,  // PIO даёт одиночный импульс, оба момента задаёт CPU;
+             // пауза - целые микросекунды (pulse_gap_us), шаг около
+             // 133 кодов при 133 МГц и 250 при 250 МГц
+};
+
+struct EncoderProgram {
+  const char *name;
+  const pio_program_t *program;
+  void (*init)(PIO pio, uint sm, uint offset, uint pin, float freq);
+  EncoderFeed feed;
+};
+
+inline constexpr EncoderProgram ENCODER_PROGRAMS[] = {
+    {"ppm", &ppm_program, ppm_program_init, EncoderFeed::Timer},
+    {"framed", &ppm_framed_program, ppm_framed_program_init,
+     EncoderFeed::SelfTimed},
+    {"pulse", &ppm_pulse_program, ppm_pulse_program_init,
+     EncoderFeed::CpuPulse},
+};
+
+inline constexpr uint ENCODER_COUNT =
+    sizeof(ENCODER_PROGRAMS) / sizeof(ENCODER_PROGRAMS[0]);
+
+class EncoderRegistry {
+public:
+  // Загрузить всё, что помещается; остальное подгружается при выборе
+  void init(PIO pio_) {
+    pio = pio_;
+    for (uint i = 0; i < ENCODER_COUNT; i++) {
+      loaded[i] = false;
+      load(i);
+    }
+  }
+
+  // Гарантировать, что программа index загружена. Неактивные программы
+  // выгружаются по одной, пока новой не хватит места.
+  bool ensure(uint index, uint active) {
+    if (loaded[index] || load(index))
+      return true;
+    for (uint i = 0; i < ENCODER_COUNT; i++) {
+      if (i == active || i == index || !loaded[i])
+        continue;
+      pio_remove_program(pio, ENCODER_PROGRAMS[i].program, offsets[i]);
+      loaded[i] = false;
+      if (load(index))
+        return true;
+    }
+    return false;
+  }
+
+  uint offset(uint index) const { return offsets[index]; }
+  bool isLoaded(uint index) const { return loaded[index]; }
+
+  static int find(const char *name, size_t len) {
+    for (uint i = 0; i < ENCODER_COUNT; i++) {
+      if (strlen(ENCODER_PROGRAMS[i].name) == len &&
+          strncmp(ENCODER_PROGRAMS[i].name, name, len) == 0)
+        return i;
+    }
+    return -1;
+  }
+
+private:
+  bool load(uint index) {
+    const pio_program_t *program = ENCODER_PROGRAMS[index].program;
+    if (!pio_can_add_program(pio, program))
+      return false;
+    offsets[index] = pio_add_program(pio, program);
+    loaded[index] = true;
+    return true;
+  }
+
+  PIO pio = nullptr;
+  uint offsets[ENCODER_COUNT] = {};
+  bool loaded[ENCODER_COUNT] = {};
+};
+
+} // namespace ppm
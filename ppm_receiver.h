@@ -0,0 +1,220 @@
+// Разнесённый приём PPM (прошивка pico_ppm_rx).
+//
+// Каждый фотоприёмник - отдельный вход: своя SM программы ppm_sample
+// (отсчёт уровня раз в RX_SAMPLE_DIV тактов) и своё кольцо DMA. Кольцо пишут по
+// очереди два сцепленных канала; проход канала кратен кольцу, поэтому
+// следующий канал продолжает с начала кольца без разрыва. poll()
+// забирает накопленные слова блоками: фронты -> FrameDecoder входа ->
+// DiversityCombiner. Обработка не зависит от числа фронтов в блоке:
+// слово без фронта стоит одну проверку.
+#pragma once
+
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+
+#include "ppm.pio.h"
+#include "ppm_decoder.h"
+#include "ppm_timing.h"
+
+namespace ppm {
+
+constexpr size_t RX_INPUTS = 2;
+static_assert(RX_INPUTS >= 1 && RX_INPUTS <= DIVERSITY_MAX_INPUTS,
+              "DiversityStats covers up to DIVERSITY_MAX_INPUTS inputs");
+// Отсчёт входа раз в RX_SAMPLE_DIV тактов. На слово входа ядру 1
+// остаётся 32 * RX_SAMPLE_DIV / RX_INPUTS тактов: при отсчёте на каждом
+// такте и двух входах это 16 тактов, впритык к разбору пустого слова
+// (около 12 тактов M0+). Цена - метка фронта с шагом RX_SAMPLE_DIV
+// тактов (код +-1), и импульс на входе должен длиться не меньше
+// RX_SAMPLE_DIV тактов: фотоприёмник растягивает импульс энкодера в
+// один такт PIO. С одним входом хватает RX_SAMPLE_DIV 1
+constexpr uint32_t RX_SAMPLE_DIV = 2;
+static_assert(RX_SAMPLE_DIV >= 1 && RX_SAMPLE_DIV * 32 >= 16 * RX_INPUTS,
+              "core 1 needs at least 16 cycles per ring word");
+// Кольцо входа 16 КБ: 4096 слов, около 2 мс при 133 МГц
+constexpr uint RX_RING_BITS = 14;
+constexpr uint32_t RX_RING_WORDS = (1u << RX_RING_BITS) / 4;
+// Проход одного канала DMA; между вызовами poll() должно пройти меньше
+constexpr uint32_t RX_SEGMENT_WORDS = RX_RING_WORDS << 16;
+constexpr uint32_t RX_BLOCK_WORDS = 512;
+// Запас до конца кольца, пока блок обрабатывается
+constexpr uint32_t RX_OVERRUN_WORDS = RX_RING_WORDS - 2 * RX_BLOCK_WORDS;
+constexpr size_t RX_COMBINER_CAPACITY = 32;
+
+struct ReceiverInputStats {
+  DecoderStats decoder;
+  uint32_t overruns = 0; // кольцо переписано раньше, чем обработано
+};
+
+class DiversityReceiver {
+public:
+  using Combiner = DiversityCombiner<RX_INPUTS, RX_COMBINER_CAPACITY>;
+
+  DiversityReceiver(PIO pio_, const uint (&pins_)[RX_INPUTS],
+                    const TimingProfile &timing)
+      : pio(pio_), combiner(timing.frame_cycles),
+        inputs{Input(make_decoder_config(timing, RX_SAMPLE_DIV)),
+               Input(make_decoder_config(timing, RX_SAMPLE_DIV))} {
+    for (size_t i = 0; i < RX_INPUTS; i++)
+      inputs[i].pin = pins_[i];
+  }
+
+  // pio_freq - частота тактов энкодера; входы отсчитываются в
+  // RX_SAMPLE_DIV раз реже
+  void start(float pio_freq) {
+    uint offset = pio_add_program(pio, &ppm_sample_program);
+    uint32_t mask = 0;
+    for (size_t i = 0; i < RX_INPUTS; i++) {
+      Input &in = inputs[i];
+      in.sm = static_cast<uint>(pio_claim_unused_sm(pio, true));
+      ppm_sample_program_init(pio, in.sm, offset, in.pin,
+                              pio_freq / RX_SAMPLE_DIV);
+      for (int k = 0; k < 2; k++)
+        in.dma[k] = static_cast<uint>(dma_claim_unused_channel(true));
+      for (int k = 0; k < 2; k++) {
+        dma_channel_config c = dma_channel_get_default_config(in.dma[k]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_ring(&c, true, RX_RING_BITS);
+        channel_config_set_dreq(&c, pio_get_dreq(pio, in.sm, false));
+        channel_config_set_chain_to(&c, in.dma[k ^ 1]);
+        dma_channel_configure(in.dma[k], &c, in.ring, &pio->rxf[in.sm],
+                              RX_SEGMENT_WORDS, false);
+      }
+      dma_channel_start(in.dma[0]);
+      mask |= 1u << in.sm;
+    }
+    // DMA уже ждёт слов: SM стартуют одним тактом
+    pio_enable_sm_mask_in_sync(pio, mask);
+  }
+
+  // Обработать всё, что накопилось в кольцах; сведённые фреймы - в sink
+  // блоками (const Frame *frames, size_t count). true, если была работа.
+  template <typename Sink> bool poll(Sink &&sink) {
+    uint32_t available[RX_INPUTS];
+    bool worked = false;
+    for (size_t i = 0; i < RX_INPUTS; i++)
+      available[i] = written(inputs[i]) - inputs[i].consumed;
+
+    for (;;) {
+      bool progress = false;
+      for (size_t i = 0; i < RX_INPUTS; i++) {
+        Input &in = inputs[i];
+        if (available[i] > RX_OVERRUN_WORDS) {
+          // Пропуск: продолжаем с середины кольца, декодер заново ищет
+          // захват, номера отсчётов остаются сквозными
+          uint32_t skip = available[i] - RX_RING_WORDS / 2;
+          in.consumed += skip;
+          available[i] -= skip;
+          in.stats.overruns++;
+          in.decoder.reset();
+          in.prev = 0;
+        }
+        uint32_t n = available[i] < RX_BLOCK_WORDS ? available[i]
+                                                    : RX_BLOCK_WORDS;
+        if (n == 0)
+          continue;
+        scan(i, n);
+        available[i] -= n;
+        progress = true;
+      }
+      if (!progress)
+        break;
+      worked = true;
+
+      // Все входы обработаны до самого отстающего
+      uint32_t horizon = inputs[0].consumed * 32 * RX_SAMPLE_DIV;
+      for (size_t i = 1; i < RX_INPUTS; i++) {
+        uint32_t t = inputs[i].consumed * 32 * RX_SAMPLE_DIV;
+        if (static_cast<int32_t>(t - horizon) < 0)
+          horizon = t;
+      }
+      size_t count =
+          combiner.combine(horizon, out, RX_INPUTS * RX_COMBINER_CAPACITY);
+      if (count > 0)
+        sink(static_cast<const Frame *>(out), count);
+    }
+    return worked;
+  }
+
+  ReceiverInputStats getInputStats(size_t i) const {
+    ReceiverInputStats s = inputs[i].stats;
+    s.decoder = inputs[i].decoder.getStats();
+    return s;
+  }
+  const DiversityStats &getStats() const { return combiner.getStats(); }
+
+private:
+  struct Input {
+    explicit Input(const DecoderConfig &cfg) : decoder(cfg) {}
+
+    alignas(1u << RX_RING_BITS) uint32_t ring[RX_RING_WORDS] = {};
+    FrameDecoder decoder;
+    ReceiverInputStats stats;
+    uint pin = 0;
+    uint sm = 0;
+    uint dma[2] = {};
+    uint8_t active = 0;     // канал DMA, пишущий сейчас
+    uint32_t segments = 0;  // пройдено проходов каналов
+    uint32_t consumed = 0;  // обработано слов с начала
+    uint32_t prev = 0;      // последний отсчёт предыдущего слова
+  };
+
+  // Слов, записанных в кольцо с начала (по модулю 2^32)
+  static uint32_t written(Input &in) {
+    if (!dma_channel_is_busy(in.dma[in.active]) &&
+        dma_channel_is_busy(in.dma[in.active ^ 1])) {
+      in.active ^= 1;
+      in.segments++;
+    }
+    uint32_t left = dma_channel_hw_addr(in.dma[in.active])->transfer_count;
+    return in.segments * RX_SEGMENT_WORDS + (RX_SEGMENT_WORDS - left);
+  }
+
+  // Фронты: отсчёт 1, перед которым 0; метка времени - номер отсчёта,
+  // умноженный на RX_SAMPLE_DIV (такты энкодера). Кольцо проходится
+  // указателем кусками до конца кольца, без маски индекса на каждом
+  // слове. Фактическую загрузку показывает core1_busy в статистике.
+  void scan(size_t i, uint32_t words) {
+    Input &in = inputs[i];
+    uint32_t prev = in.prev;
+    while (words > 0) {
+      uint32_t at = in.consumed & (RX_RING_WORDS - 1);
+      uint32_t n = RX_RING_WORDS - at < words ? RX_RING_WORDS - at : words;
+      const uint32_t *p = &in.ring[at];
+      const uint32_t *end = p + n;
+      for (; p != end; p++) {
+        uint32_t w = *p;
+        uint32_t rising = w & ~((w << 1) | prev);
+        prev = w >> 31;
+        if (rising)
+          edges(i, in.consumed + static_cast<uint32_t>(p - &in.ring[at]),
+                rising);
+      }
+      in.consumed += n;
+      words -= n;
+    }
+    in.prev = prev;
+  }
+
+  void edges(size_t i, uint32_t index, uint32_t rising) {
+    Input &in = inputs[i];
+    do {
+      Frame frame;
+      uint32_t sample =
+          index * 32 + static_cast<uint32_t>(__builtin_ctz(rising));
+      uint32_t t = sample * RX_SAMPLE_DIV;
+      if (in.decoder.push(t, frame))
+        combiner.push(i, frame, in.decoder.isLocked());
+      rising &= rising - 1;
+    } while (rising);
+  }
+
+  PIO pio;
+  Combiner combiner;
+  Input inputs[RX_INPUTS];
+  Frame out[RX_INPUTS * RX_COMBINER_CAPACITY];
+};
+
+} // namespace ppm
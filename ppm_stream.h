@@ -0,0 +1,178 @@
+// Разбор входного потока CDC: текстовые команды вперемешку с двоичными
+// блоками отсчётов.
+//
+// Блок: BLOCK_MAGIC, тип, число отсчётов (uint16 LE), затем отсчёты int16 LE.
+// Байт BLOCK_MAGIC не встречается в текстовых командах, поэтому блок может
+// начинаться в любом месте потока, кроме середины строки. Первый отсчёт
+// блока-метки помечается для замера задержки от приёма до вывода.
+// Заголовок не зависит от Pico SDK.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "ppm_command.h"
+
+namespace ppm {
+
+constexpr uint8_t BLOCK_MAGIC = 0xA5;
+constexpr size_t BLOCK_HEADER_SIZE = 4;
+constexpr size_t COMMAND_LINE_SIZE = 64;
+// Отсчёты передаются приёмнику порциями до этого размера
+constexpr size_t STREAM_BLOCK_SIZE = 32;
+
+enum class BlockType : uint8_t {
+  Pcm = 'P',    // отсчёты int16, для TDM чередуются L,R
+  Marker = 'M', // то же, первый отсчёт - метка замера задержки
+};
+
+// Профиль буферизации: глубина очереди отсчётов, порция чтения из CDC и
+// порция обработки DSP. Мелкие буферы уменьшают задержку, глубокие
+// переживают паузы хоста без опустошения очереди.
+struct BufferProfile {
+  const char *name;
+  uint16_t queue_depth; // отсчётов
+  uint16_t read_size;   // байт за одно чтение CDC
+  uint8_t block_size;   // отсчётов в порции для приёмника
+};
+
+inline constexpr BufferProfile BUFFER_PROFILES[] = {
+    {"throughput", 1024, 256, 32},
+    {"latency", 32, 16, 8},
+};
+
+inline constexpr size_t BUFFER_PROFILE_COUNT =
+    sizeof(BUFFER_PROFILES) / sizeof(BUFFER_PROFILES[0]);
+
+inline int find_buffer_profile(std::string_view name) {
+  for (size_t i = 0; i < BUFFER_PROFILE_COUNT; i++) {
+    if (name_equals(name, BUFFER_PROFILES[i].name))
+      return static_cast<int>(i);
+  }
+  return -1;
+}
+
+struct InputResult {
+  bool echo; // текстовый байт, вернуть эхом
+  bool line; // строка завершена и лежит в line()
+};
+
+// Sink::write(int16_t *samples, size_t count) получает порции отсчётов и
+// может обработать их на месте; возвращает число принятых отсчётов.
+// Sink::mark() вызывается перед первым отсчётом блока-метки.
+template <typename Sink> class StreamParser {
+public:
+  explicit StreamParser(Sink &sink_) : sink(sink_) {}
+
+  // Свободного места у приёмника должно хватать на прочитанный кусок:
+  // основной цикл читает из CDC не больше, чем приёмник может принять.
+  InputResult feed(uint8_t byte) {
+    switch (state) {
+    case State::Text:
+      return feedText(byte);
+    case State::Header:
+      header[headerLen++] = byte;
+      if (headerLen == BLOCK_HEADER_SIZE) {
+        remaining = static_cast<uint16_t>(header[2] | (header[3] << 8));
+        state = remaining > 0 ? State::Payload : State::Text;
+        if (header[1] == static_cast<uint8_t>(BlockType::Marker) &&
+            remaining > 0) {
+          flush();
+          sink.mark();
+          header[1] = static_cast<uint8_t>(BlockType::Pcm);
+        }
+        if (header[1] != static_cast<uint8_t>(BlockType::Pcm))
+          badBlocks++;
+      }
+      return {false, false};
+    case State::Payload:
+      if (!haveLow) {
+        low = byte;
+        haveLow = true;
+        return {false, false};
+      }
+      haveLow = false;
+      if (header[1] == static_cast<uint8_t>(BlockType::Pcm)) {
+        block[blockLen++] = static_cast<int16_t>(low | (byte << 8));
+      }
+      if (--remaining == 0) {
+        state = State::Text;
+        flush();
+      } else if (blockLen >= blockSize) {
+        flush();
+      }
+      return {false, false};
+    }
+    return {false, false};
+  }
+
+  const LineBuffer<COMMAND_LINE_SIZE> &line() const { return lineBuf; }
+  void clearLine() { lineBuf.clear(); }
+
+  // Отдать накопленные отсчёты, не дожидаясь конца блока
+  void flush() {
+    if (blockLen == 0)
+      return;
+    dropped += blockLen - sink.write(block, blockLen);
+    blockLen = 0;
+  }
+
+  // Порция для приёмника, не больше STREAM_BLOCK_SIZE
+  void setBlockSize(size_t n) {
+    blockSize = n == 0 || n > STREAM_BLOCK_SIZE ? STREAM_BLOCK_SIZE : n;
+    if (blockLen >= blockSize)
+      flush();
+  }
+
+  // Сброс при потере соединения
+  void reset() {
+    state = State::Text;
+    lineBuf.clear();
+    haveLow = false;
+    blockLen = 0;
+  }
+
+  uint32_t getDropped() const { return dropped; }
+  uint32_t getBadBlocks() const { return badBlocks; }
+
+private:
+  enum class State : uint8_t { Text, Header, Payload };
+
+  InputResult feedText(uint8_t byte) {
+    char c = static_cast<char>(byte);
+    if (byte == BLOCK_MAGIC && lineBuf.empty()) {
+      header[0] = byte;
+      headerLen = 1;
+      haveLow = false;
+      state = State::Header;
+      return {false, false};
+    }
+    // Проверяем, нажат ли Enter
+    if (c == '\r' || c == '\n')
+      return {true, !lineBuf.empty()};
+    if (c == 127 || c == 8) {
+      // Обработка Backspace или Delete
+      lineBuf.pop();
+    } else {
+      lineBuf.push(c);
+    }
+    return {true, false};
+  }
+
+  Sink &sink;
+  LineBuffer<COMMAND_LINE_SIZE> lineBuf;
+  int16_t block[STREAM_BLOCK_SIZE];
+  size_t blockLen = 0;
+  size_t blockSize = STREAM_BLOCK_SIZE;
+  State state = State::Text;
+  uint8_t header[BLOCK_HEADER_SIZE] = {};
+  size_t headerLen = 0;
+  uint16_t remaining = 0;
+  uint8_t low = 0;
+  bool haveLow = false;
+  uint32_t dropped = 0;
+  uint32_t badBlocks = 0;
+};
+
+} // namespace ppm
@@ -0,0 +1,141 @@
+// Временные параметры PPM, зависящие от системной частоты.
+//
+// Раньше все величины считались из макроса SYS_FREQ на этапе компиляции;
+// теперь профиль можно пересчитать при смене частоты на лету.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ppm {
+
+constexpr float MIN_PULSE_PERIOD_US = 3.0f;  // 3.0 microseconds
+constexpr float AUDIO_SAMPLE_RATE = 48000.0f; // 48 kHz
+constexpr uint16_t MAX_CODE = 1024;
+
+// Период отсчёта в тиках таймера (мкс). Считается, как в исходной прошивке
+// при SYS_FREQ 133000, и от профиля частоты не зависит: другая частота
+// меняет только число тактов PIO во фрейме (разрешение кода), а не частоту
+// отсчётов.
+constexpr uint32_t SAMPLE_PERIOD_BASE_KHZ = 133000;
+constexpr uint32_t SAMPLE_PERIOD_US =
+    static_cast<uint32_t>(SAMPLE_PERIOD_BASE_KHZ * 10.0 / AUDIO_SAMPLE_RATE);
+
+struct TimingProfile {
+  uint32_t sys_khz;             // частота clk_sys
+  float pio_freq;               // частота тактирования SM, Гц
+  uint16_t min_interval_cycles; // минимальная пауза между импульсами
+  uint32_t frame_ticks;         // период фрейма в тиках таймера
+  uint32_t frame_cycles;        // период фрейма в тактах PIO
+  uint8_t slots;                // фреймов на отсчёт
+};
+
+// slots - число фреймов на период отсчёта (2 для стерео TDM)
+constexpr TimingProfile make_timing_profile(uint32_t sys_khz,
+                                            uint8_t slots = 1) {
+  return TimingProfile{
+      sys_khz,
+      sys_khz * 1000.0f,
+      static_cast<uint16_t>(MIN_PULSE_PERIOD_US * (sys_khz / 1000)),
+      SAMPLE_PERIOD_US / slots,
+      SAMPLE_PERIOD_US / slots * (sys_khz / 1000),
+      slots,
+  };
+}
+
+// Действительная частота отсчётов профиля, Гц
+constexpr double sample_rate(const TimingProfile &t) {
+  return 1e6 / (double(t.frame_ticks) * t.slots);
+}
+
+// Такты от начала первого импульса фрейма до начала второго
+constexpr uint32_t code_gap(const TimingProfile &t, uint16_t code) {
+  return t.min_interval_cycles + code + 3;
+}
+
+// Калибровка нелинейности тракта: поправка интервала в тактах в узлах
+// через каждые CALIBRATION_STEP кодов, между узлами - линейно
+constexpr uint16_t CALIBRATION_STEP = 128;
+constexpr size_t CALIBRATION_POINTS = MAX_CODE / CALIBRATION_STEP + 1;
+
+struct CalibrationTable {
+  int8_t trim[CALIBRATION_POINTS];
+
+  constexpr int32_t at(uint16_t code) const {
+    size_t i = code / CALIBRATION_STEP;
+    if (i >= CALIBRATION_POINTS - 1)
+      return trim[CALIBRATION_POINTS - 1];
+    int32_t frac = code % CALIBRATION_STEP;
+    return (trim[i] * (CALIBRATION_STEP - frac) + trim[i + 1] * frac) /
+           CALIBRATION_STEP;
+  }
+};
+
+constexpr uint32_t calibrated_gap(const TimingProfile &t,
+                                  const CalibrationTable &cal, uint16_t code) {
+  return code_gap(t, code) + cal.at(code);
+}
+
+constexpr uint32_t min_gap(const TimingProfile &t) { return code_gap(t, 0); }
+constexpr uint32_t max_gap(const TimingProfile &t) {
+  return code_gap(t, MAX_CODE);
+}
+
+// Пауза программы pulse: второй импульс ставит таймер, поэтому шаг -
+// микросекунда, sys_khz / 1000 тактов (около 133 кодов при 133 МГц).
+// Ближайшая к gap пауза в пределах [min_gap, max_gap], иначе приёмник
+// не примет фрейм
+constexpr uint32_t pulse_gap_us(const TimingProfile &t, uint32_t gap) {
+  const uint32_t per_us = t.sys_khz / 1000;
+  const uint32_t lo = (min_gap(t) + per_us - 1) / per_us;
+  const uint32_t hi = max_gap(t) / per_us;
+  const uint32_t us = (gap + per_us / 2) / per_us;
+  return us < lo ? lo : us > hi ? hi : us;
+}
+
+// От второго импульса самого длинного кода до начала следующего фрейма
+// не меньше минимальной паузы. Иначе эта пара сама проходит как код, и
+// приёмник, начавший с импульса кода, при ровном звуке остаётся в чужой
+// фазе (так было с TDM при 133 МГц).
+constexpr bool frame_fits(const TimingProfile &t) {
+  return t.frame_cycles >= max_gap(t) + t.min_interval_cycles;
+}
+
+// Допуск приёмника на начало фрейма, такты
+constexpr uint32_t frame_tolerance(const TimingProfile &t) {
+  return t.frame_cycles / 64 + 4;
+}
+
+// Преамбула синхронизации: раз в несколько фреймов энкодер ставит вместо
+// кода интервал sync_gap, которого нет среди кодов. Приёмник, включившийся
+// посреди потока, по нему сразу узнаёт первый импульс фрейма. Цена -
+// настоящий отсчёт: преамбула занимает место фрейма, его отсчёт
+// выбрасывается и приёмник повторяет предыдущий. В TDM она встаёт на
+// левый слот, а правый слот её пары приёмник отбрасывает - теряется вся
+// пара L/R. При SYNC_MIN_INTERVAL это каждый восьмой фрейм (12.5%).
+constexpr uint32_t SYNC_MIN_INTERVAL = 8; // фреймов между преамбулами
+
+constexpr uint32_t sync_gap(const TimingProfile &t) {
+  return max_gap(t) + t.min_interval_cycles / 2;
+}
+
+// Преамбула не путается ни с кодом при любой калибровке, ни с интервалом
+// от её второго импульса до начала следующего фрейма. Во фрейме TDM при
+// 133 МГц места для неё нет.
+constexpr bool sync_fits(const TimingProfile &t) {
+  return sync_gap(t) - frame_tolerance(t) > max_gap(t) + INT8_MAX &&
+         t.frame_cycles > 2 * sync_gap(t) + frame_tolerance(t);
+}
+
+// Допустимые профили системной частоты, МГц
+inline constexpr uint32_t CLOCK_PROFILES_MHZ[] = {133, 250};
+
+constexpr bool is_clock_profile(uint32_t mhz) {
+  for (uint32_t p : CLOCK_PROFILES_MHZ) {
+    if (p == mhz)
+      return true;
+  }
+  return false;
+}
+
+} // namespace ppm